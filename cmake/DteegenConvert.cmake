@@ -0,0 +1,53 @@
+# dteegen_convert(<name> PROJECT <project_dir> [OUTPUT <dir>]
+#                 [WORKING_DIRECTORY <dir>] [DTEEGEN <path>] [ARGS <args>...])
+#
+# Adds a target <name> running `dteegen convert <project_dir>` in
+# WORKING_DIRECTORY (which needs the template directory). The project is
+# generated into OUTPUT, `generated` by default, relative to
+# WORKING_DIRECTORY. dteegen writes a depfile of everything it read, so the
+# conversion only reruns when one of those changed. <name>_STAMP is set to the stamp file, depend on it to order
+# builds of the generated tree after the conversion.
+#
+# DEPFILE needs CMake 3.20 with the Makefile generators, Ninja has it since
+# 3.7.
+function(dteegen_convert name)
+  cmake_parse_arguments(ARG "" "PROJECT;OUTPUT;WORKING_DIRECTORY;DTEEGEN" "ARGS" ${ARGN})
+  if(NOT ARG_PROJECT)
+    message(FATAL_ERROR "dteegen_convert: PROJECT is required")
+  endif()
+  if(NOT ARG_WORKING_DIRECTORY)
+    set(ARG_WORKING_DIRECTORY ${CMAKE_CURRENT_SOURCE_DIR})
+  endif()
+  if(NOT ARG_DTEEGEN)
+    if(TARGET dteegen)
+      set(ARG_DTEEGEN $<TARGET_FILE:dteegen>)
+    else()
+      find_program(ARG_DTEEGEN dteegen REQUIRED)
+    endif()
+  endif()
+
+  if(NOT ARG_OUTPUT)
+    set(ARG_OUTPUT generated)
+  endif()
+  get_filename_component(OUTPUT_DIR ${ARG_OUTPUT} ABSOLUTE
+    BASE_DIR ${ARG_WORKING_DIRECTORY})
+
+  set(STAMP ${OUTPUT_DIR}/dteegen.stamp)
+  set(DEPFILE ${CMAKE_CURRENT_BINARY_DIR}/${name}.d)
+  set(DEPENDS "")
+  if(TARGET dteegen)
+    list(APPEND DEPENDS dteegen)
+  endif()
+
+  add_custom_command(
+    OUTPUT ${STAMP}
+    COMMAND ${ARG_DTEEGEN} ${ARG_ARGS} --depfile ${DEPFILE} --stamp ${STAMP}
+            convert -o ${OUTPUT_DIR} ${ARG_PROJECT}
+    DEPFILE ${DEPFILE}
+    DEPENDS ${DEPENDS}
+    WORKING_DIRECTORY ${ARG_WORKING_DIRECTORY}
+    COMMENT "dteegen convert ${ARG_PROJECT}"
+    VERBATIM)
+  add_custom_target(${name} ALL DEPENDS ${STAMP})
+  set(${name}_STAMP ${STAMP} PARENT_SCOPE)
+endfunction()
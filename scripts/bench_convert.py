@@ -0,0 +1,219 @@
+#!/bin/python3
+# Benchmark `dteegen convert` on synthetic projects.
+#
+# A project with the requested shape is generated into a scratch directory,
+# then converted once per --jobs value (and per --repeat). Wall time, the
+# per-phase times dteegen logs ("PHASE <name>: <ms>ms"), peak RSS and files/sec
+# are written as JSON, so runs can be diffed to spot scaling regressions.
+import argparse
+import json
+import os
+import re
+import shutil
+import sys
+import tempfile
+import time
+
+REPO_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+PHASE_RE = re.compile(r'^PHASE (\S+): (\d+)ms$', re.M)
+
+ROOT_CMAKE = '''cmake_minimum_required(VERSION 3.16)
+project({name} C CXX)
+
+set(CMAKE_CXX_STANDARD 17)
+add_subdirectory(secure)
+add_subdirectory(insecure)
+'''
+
+SECURE_CMAKE = '''add_subdirectory(secure_include)
+add_subdirectory(secure_lib)
+
+add_library(secure {sources})
+
+target_include_directories(secure PRIVATE ${{INCLUDE_DIRS}})
+target_link_libraries(secure
+  ${{STATIC_LIBS}}
+)
+'''
+
+INSECURE_CMAKE = '''add_executable(${{PROJECT_NAME}} {sources})
+
+target_link_libraries(${{PROJECT_NAME}} secure distributed_tee)
+'''
+
+SECURE_INCLUDE_CMAKE = '''set(INCLUDE_DIRS "${CMAKE_CURRENT_SOURCE_DIR}")
+set(INCLUDE_DIRS ${INCLUDE_DIRS} PARENT_SCOPE)
+'''
+
+SECURE_LIB_CMAKE = '''set(STATIC_LIBS "")
+set(STATIC_LIBS ${STATIC_LIBS} PARENT_SCOPE)
+'''
+
+
+def write(path, content):
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(path, 'w') as f:
+        f.write(content)
+
+
+def make_project(root, args):
+    """Generate a synthetic project. Returns the number of source files."""
+    name = os.path.basename(root)
+    secure = os.path.join(root, 'secure')
+    insecure = os.path.join(root, 'insecure')
+
+    write(os.path.join(root, 'CMakeLists.txt'), ROOT_CMAKE.format(name=name))
+    write(os.path.join(secure, 'secure_include', 'CMakeLists.txt'),
+          SECURE_INCLUDE_CMAKE)
+    write(os.path.join(secure, 'secure_lib', 'CMakeLists.txt'),
+          SECURE_LIB_CMAKE)
+
+    # a chain of headers, the last one embeds a model-like array
+    for d in range(args.header_depth):
+        body = '#pragma once\n'
+        if d + 1 < args.header_depth:
+            body += '#include "h%d.h"\n' % (d + 1)
+        else:
+            data = ','.join(str(i % 251) for i in range(args.array_size))
+            body += 'static const unsigned char g_blob[] = {%s};\n' % data
+        body += 'static inline int depth_%d(int x) { return x + %d; }\n' % (d, d)
+        write(os.path.join(secure, 'include', 'h%d.h' % d), body)
+
+    secure_sources = []
+    for i in range(args.secure_files):
+        decls = ''.join('int sec_%d_%d(int x);\n' % (i, j)
+                        for j in range(args.funcs))
+        write(os.path.join(secure, 'sec_%d.h' % i), '#pragma once\n' + decls)
+
+        src = '#include "sec_%d.h"\n' % i
+        if args.header_depth:
+            src += '#include "include/h0.h"\n'
+        for j in range(args.funcs):
+            src += 'int sec_%d_%d(int x) { return x * %d + %d; }\n' % (i, j, i,
+                                                                      j)
+        write(os.path.join(secure, 'sec_%d.cpp' % i), src)
+        secure_sources.append('sec_%d.cpp' % i)
+    write(os.path.join(secure, 'CMakeLists.txt'),
+          SECURE_CMAKE.format(sources=' '.join(secure_sources)))
+
+    insecure_sources = []
+    for i in range(args.insecure_files):
+        src = ''.join('#include "../secure/sec_%d.h"\n' % k
+                      for k in range(args.secure_files))
+        src += 'int ins_%d(int x) {\n  int r = x;\n' % i
+        for k in range(args.secure_files):
+            for j in range(args.funcs):
+                src += '  r += sec_%d_%d(r);\n' % (k, j)
+        src += '  return r;\n}\n'
+        if i == 0:
+            src += 'int main() { return ins_0(1); }\n'
+        write(os.path.join(insecure, 'ins_%d.cpp' % i), src)
+        insecure_sources.append('ins_%d.cpp' % i)
+    write(os.path.join(insecure, 'CMakeLists.txt'),
+          INSECURE_CMAKE.format(sources=' '.join(insecure_sources)))
+
+    return args.secure_files + args.insecure_files
+
+
+def run_convert(dteegen, workdir, project, jobs, extra):
+    out_path = os.path.join(workdir, 'convert.log')
+    argv = [dteegen, '-j', str(jobs)] + extra + ['convert', project]
+    start = time.monotonic()
+    pid = os.fork()
+    if pid == 0:
+        os.chdir(workdir)
+        fd = os.open(out_path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC)
+        os.dup2(fd, 1)
+        os.dup2(fd, 2)
+        try:
+            os.execv(dteegen, argv)
+        finally:
+            os._exit(127)
+    _, status, rusage = os.wait4(pid, 0)
+    wall_ms = (time.monotonic() - start) * 1000
+
+    with open(out_path) as f:
+        log = f.read()
+    phases = {name: int(ms) for name, ms in PHASE_RE.findall(log)}
+    return {
+        'exit_code': os.waitstatus_to_exitcode(status),
+        'wall_ms': round(wall_ms, 1),
+        'phases_ms': phases,
+        # linux reports ru_maxrss in KiB
+        'peak_rss_kb': rusage.ru_maxrss,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Benchmark dteegen convert on a synthetic project')
+    parser.add_argument('--dteegen',
+                        default=os.path.join(REPO_ROOT, 'build', 'dteegen'))
+    parser.add_argument('--template', default=os.path.join(REPO_ROOT,
+                                                           'template'))
+    parser.add_argument('--secure-files', type=int, default=16)
+    parser.add_argument('--insecure-files', type=int, default=16)
+    parser.add_argument('--funcs', type=int, default=8,
+                        help='entry functions per secure file')
+    parser.add_argument('--header-depth', type=int, default=4)
+    parser.add_argument('--array-size', type=int, default=65536,
+                        help='elements of the array embedded in the headers')
+    parser.add_argument('--jobs', default='1,2,4,8',
+                        help='comma separated list of --jobs to run with')
+    parser.add_argument('--repeat', type=int, default=3)
+    parser.add_argument('--extra-args', default='',
+                        help='extra args passed to dteegen, e.g. a cache mode')
+    parser.add_argument('--output', default='-', help='JSON output, - for stdout')
+    args = parser.parse_args()
+
+    dteegen = os.path.abspath(args.dteegen)
+    if not os.path.isfile(dteegen):
+        print('dteegen not found at %s, build it first' % dteegen,
+              file=sys.stderr)
+        sys.exit(1)
+
+    workdir = tempfile.mkdtemp(prefix='dteegen_bench_')
+    try:
+        os.symlink(os.path.abspath(args.template),
+                   os.path.join(workdir, 'template'))
+        project = 'bench_project'
+        n_files = make_project(os.path.join(workdir, project), args)
+
+        runs = []
+        for jobs in (int(j) for j in args.jobs.split(',')):
+            for r in range(args.repeat):
+                res = run_convert(dteegen, workdir, project, jobs,
+                                  args.extra_args.split())
+                res['jobs'] = jobs
+                res['repeat'] = r
+                res['files_per_sec'] = round(
+                    n_files / (res['wall_ms'] / 1000), 2) if res['wall_ms'] else 0
+                runs.append(res)
+                print('jobs=%d #%d: %.1fms rss=%dKiB exit=%d' %
+                      (jobs, r, res['wall_ms'], res['peak_rss_kb'],
+                       res['exit_code']), file=sys.stderr)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    report = {
+        'params': {
+            'secure_files': args.secure_files,
+            'insecure_files': args.insecure_files,
+            'funcs': args.funcs,
+            'header_depth': args.header_depth,
+            'array_size': args.array_size,
+            'extra_args': args.extra_args,
+        },
+        'source_files': n_files,
+        'runs': runs,
+    }
+    if args.output == '-':
+        json.dump(report, sys.stdout, indent=2)
+        print()
+    else:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,7 +1,7 @@
 #!/bin/bash
 
-if [ $# -ne 1 ]; then
-	echo "Usage: $0 <target>"
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+	echo "Usage: $0 <target> [Release|Debug|PGO_GENERATE|PGO_USE]"
 	exit 1
 fi
 
@@ -12,6 +12,17 @@ fi
 
 TARGET=$(realpath $1)
 
+# the enclave build profile defaults to what dteegen --profile generated
+PROFILE=$2
+PROFILE_FLAG=""
+BUILD_TYPE=Release
+if [ -n "$PROFILE" ]; then
+	PROFILE_FLAG="-DENCLAVE_BUILD_PROFILE=$PROFILE"
+fi
+if [ "$PROFILE" = "Debug" ]; then
+	BUILD_TYPE=Debug
+fi
+
 mkdir -p $TARGET/build
 
 # 定义Docker镜像名称
@@ -26,7 +37,7 @@ docker run -v "$TARGET:/workspace/secGear/examples/generated" \
     export CC=riscv64-linux-gnu-gcc &&
     export CXX=riscv64-linux-gnu-g++ &&
     export PATH=/root/.opam/4.12.0/bin:$PATH:/workspace/secGear/debug
-    cmake -DCMAKE_BUILD_TYPE=Debug -DENCLAVE=PL -DSDK_PATH=/root/dev/sdk -DSSL_PATH=/root/dev/sdk/penglai_sdk_ssl .. &&
+    cmake -DCMAKE_BUILD_TYPE=$BUILD_TYPE $PROFILE_FLAG -DENCLAVE=PL -DSDK_PATH=/root/dev/sdk -DSSL_PATH=/root/dev/sdk/penglai_sdk_ssl .. &&
     make -j8 && 
     cp -r /workspace/secGear/debug/examples/generated/host/insecure/* /workspace/secGear/examples/generated/build/ &&
     mv /workspace/secGear/examples/generated/enclave/penglai*ELF /workspace/secGear/examples/generated/enclave/enclave.signed.so &&
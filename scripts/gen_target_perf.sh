@@ -5,6 +5,6 @@ if [ $# -ne 1 ]; then
 	exit 1
 fi
 
-CODEGEN=./build/codegen
+CODEGEN=./build/dteegen
 
 perf record --call-graph dwarf $CODEGEN convert $1
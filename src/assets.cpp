@@ -0,0 +1,148 @@
+#include "assets.h"
+
+#include <algorithm>
+
+#include "fs.h"
+#include "z_sha256.h"
+
+namespace {
+
+// keep in sync with z_assets.h
+constexpr char MAGIC[8] = {'D', 'T', 'E', 'E', 'A', 'S', 'S', 'T'};
+constexpr uint32_t VERSION = 1;
+constexpr size_t HEADER_SIZE = 24;
+constexpr size_t NAME_MAX_LEN = 112;
+constexpr size_t ENTRY_SIZE = NAME_MAX_LEN + 16;
+// of the data of each asset in the bundle
+constexpr uint64_t DATA_ALIGN = 64;
+
+// the bundle is little endian, as the hosts and enclaves dteegen targets
+void put_le(std::string &out, uint64_t v, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; ++i) {
+        out.push_back((char)(v >> (i * 8)));
+    }
+}
+
+uint64_t align_up(uint64_t n)
+{
+    return (n + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+}
+
+}  // namespace
+
+std::string xxd_symbol(const std::filesystem::path &path)
+{
+    std::string res;
+    const auto name = path.generic_string();
+    if (!name.empty() && std::isdigit((unsigned char)name[0])) {
+        res = "__";
+    }
+    for (const char c : name) {
+        res += std::isalnum((unsigned char)c) ? c : '_';
+    }
+    return res;
+}
+
+EmbeddedFiles embed_files(const std::filesystem::path &dir,
+                          const std::filesystem::path &to)
+{
+    std::vector<std::filesystem::path> files;
+    for_each_file_in_path_recursive(
+        dir, [&](const auto &f) { files.push_back(f.path()); });
+    std::sort(files.begin(), files.end());
+
+    EmbeddedFiles res;
+    std::unordered_set<std::string> symbols;
+    for (const auto &f : files) {
+        const auto rel = f.lexically_relative(dir);
+        const auto sym = xxd_symbol(rel);
+        ASSERT(symbols.insert(sym).second,
+               "embedded files %s and another are both named %s, rename one",
+               f.c_str(), sym.c_str());
+        std::filesystem::create_directories((to / rel).parent_path());
+        std::filesystem::copy_file(
+            f, to / rel, std::filesystem::copy_options::overwrite_existing);
+
+        ++res.count;
+        res.bytes += std::filesystem::file_size(f);
+        std::stringstream s;
+        s << "\n    .global " << sym << ", " << sym << "_end, " << sym
+          << "_len\n    .type " << sym << ", @object\n    .balign 64\n"
+          << sym << ":\n    .incbin \""
+          << (to.filename() / rel).generic_string() << "\"\n"
+          << sym << "_end:\n    .size " << sym << ", " << sym << "_end - "
+          << sym << "\n    .balign 4\n"
+          << sym << "_len:\n    .long " << sym << "_end - " << sym << "\n";
+        res.assembly += s.str();
+        res.declarations += "\n    extern const unsigned char " + sym +
+                            "[], " + sym + "_end[];\n    extern const "
+                            "unsigned int " + sym + "_len;";
+    }
+    return res;
+}
+
+AssetBundle pack_assets(const std::filesystem::path &dir,
+                        const std::filesystem::path &bundle)
+{
+    std::vector<std::filesystem::path> files;
+    for_each_file_in_path_recursive(
+        dir, [&](const auto &f) { files.push_back(f.path()); });
+    // the same assets make the same bundle, and the same hash
+    std::sort(files.begin(), files.end());
+
+    AssetBundle res;
+    res.count = files.size();
+    std::string head;
+    std::vector<uint64_t> offsets;
+    uint64_t offset = align_up(HEADER_SIZE + ENTRY_SIZE * files.size());
+    for (const auto &f : files) {
+        const auto name = f.lexically_relative(dir).generic_string();
+        ASSERT(name.size() < NAME_MAX_LEN,
+               "asset name %s is longer than %zu chars", name.c_str(),
+               NAME_MAX_LEN - 1);
+        const uint64_t size = std::filesystem::file_size(f);
+        std::string entry(name);
+        entry.resize(NAME_MAX_LEN, '\0');
+        put_le(entry, offset, 8);
+        put_le(entry, size, 8);
+        head += entry;
+        offsets.push_back(offset);
+        offset = align_up(offset + size);
+    }
+    res.size = offset;
+    std::string header(MAGIC, sizeof(MAGIC));
+    put_le(header, VERSION, 4);
+    put_le(header, files.size(), 4);
+    put_le(header, res.size, 8);
+    head = header + head;
+    head.resize(align_up(head.size()), '\0');
+
+    std::filesystem::create_directories(bundle.parent_path());
+    std::ofstream out(bundle, std::ios::binary);
+    ASSERT(out, "Unable to write %s", bundle.c_str());
+    dtee::sha256 sha;
+    const auto write = [&](const char *data, size_t n) {
+        out.write(data, n);
+        sha.update(data, n);
+    };
+    write(head.data(), head.size());
+    std::vector<char> buf(1 << 20);
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::ifstream in(files[i], std::ios::binary);
+        ASSERT(in, "Unable to read %s", files[i].c_str());
+        uint64_t written = 0;
+        while (in) {
+            in.read(buf.data(), buf.size());
+            write(buf.data(), in.gcount());
+            written += in.gcount();
+        }
+        const std::string pad(align_up(offsets[i] + written) -
+                                  (offsets[i] + written),
+                              '\0');
+        write(pad.data(), pad.size());
+    }
+    ASSERT(out.flush(), "Unable to write %s", bundle.c_str());
+    sha.finish(res.hash.data());
+    return res;
+}
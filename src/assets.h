@@ -0,0 +1,38 @@
+#pragma once
+#include <array>
+
+#include "pch.h"
+
+// the files under assets/ of a project, packed into one bundle which the
+// enclave loads at runtime instead of having them compiled in
+struct AssetBundle {
+  size_t count = 0;
+  // of the whole bundle
+  uint64_t size = 0;
+  // SHA-256 of the whole bundle, the enclave only uses a bundle with it
+  std::array<uint8_t, 32> hash{};
+};
+
+/// @brief pack the files under dir into the file bundle, in the format
+/// z_assets.h describes. Files are named by their path relative to dir.
+AssetBundle pack_assets(const std::filesystem::path &dir,
+                        const std::filesystem::path &bundle);
+
+// the files under embed/ of a project, linked into the enclave as they are
+struct EmbeddedFiles {
+  size_t count = 0;
+  uintmax_t bytes = 0;
+  // .incbin directives, see embed.S
+  std::string assembly;
+  // declarations of the symbols, see z_embed.h
+  std::string declarations;
+};
+
+/// @brief the symbol xxd -i names the array of the file at path (relative
+/// to where xxd runs) by
+std::string xxd_symbol(const std::filesystem::path &path);
+
+/// @brief copy the files under dir to to, and write the assembly which
+/// links them in from there (relative to the parent of to)
+EmbeddedFiles embed_files(const std::filesystem::path &dir,
+                          const std::filesystem::path &to);
@@ -0,0 +1,293 @@
+#include "boundary.h"
+
+#include <algorithm>
+
+#include "clang-c/CXString.h"
+#include "clang-c/Index.h"
+#include "libclang.h"
+#include "parser.h"
+#include "template.h"
+
+namespace {
+
+// report at most this many pairs and suggestions
+constexpr size_t MAX_REPORTED = 20;
+
+struct Sites
+{
+    const std::unordered_set<std::string> *callees;
+    std::vector<CrossingSite> res;
+};
+
+// parse_file hands the visitor the file context, the sites go here
+thread_local Sites *tls_sites = nullptr;
+
+struct Walk
+{
+    Sites &sites;
+    const std::string &caller;
+    unsigned loop_depth;
+};
+
+std::string spelling(CXString str)
+{
+    std::string res = clang_getCString(str);
+    clang_disposeString(str);
+    return res;
+}
+
+std::string location_of(CXCursor cursor)
+{
+    CXFile file = nullptr;
+    unsigned line = 0;
+    clang_getSpellingLocation(clang_getCursorLocation(cursor), &file, &line,
+                              nullptr, nullptr);
+    if (file == nullptr) {
+        return "";
+    }
+    return spelling(clang_getFileName(file)) + ":" + std::to_string(line);
+}
+
+bool is_loop(CXCursorKind kind)
+{
+    return kind == CXCursor_ForStmt || kind == CXCursor_WhileStmt ||
+           kind == CXCursor_DoStmt || kind == CXCursor_CXXForRangeStmt;
+}
+
+CXChildVisitResult walk_body(CXCursor cursor, CXCursor, CXClientData data)
+{
+    auto &w = *static_cast<Walk *>(data);
+    const auto kind = clang_getCursorKind(cursor);
+    if (kind == CXCursor_CallExpr) {
+        const CXCursor ref = clang_getCursorReferenced(cursor);
+        // unresolved calls still have the name
+        const auto callee = spelling(clang_getCursorSpelling(
+            clang_Cursor_isNull(ref) ? cursor : ref));
+        if (w.sites.callees->count(callee) != 0) {
+            w.sites.res.push_back(
+                {w.caller, callee, location_of(cursor), w.loop_depth});
+        }
+    }
+    Walk inner{w.sites, w.caller, w.loop_depth + is_loop(kind)};
+    clang_visitChildren(cursor, walk_body, &inner);
+    return CXChildVisit_Continue;
+}
+
+CXChildVisitResult crossing_site_collect_visitor(CXCursor cursor, CXCursor,
+                                                 CXClientData)
+{
+    const auto kind = clang_getCursorKind(cursor);
+    switch (kind) {
+    case CXCursor_Namespace:
+    case CXCursor_LinkageSpec:
+    case CXCursor_ClassDecl:
+    case CXCursor_StructDecl:
+    case CXCursor_ClassTemplate:
+        return CXChildVisit_Recurse;
+    case CXCursor_FunctionDecl:
+    case CXCursor_CXXMethod:
+    case CXCursor_Constructor:
+    case CXCursor_Destructor:
+    case CXCursor_FunctionTemplate:
+        break;
+    default:
+        return CXChildVisit_Continue;
+    }
+    if (!clang_isCursorDefinition(cursor) ||
+        !clang_Location_isFromMainFile(clang_getCursorLocation(cursor))) {
+        return CXChildVisit_Continue;
+    }
+
+    std::string caller = spelling(clang_getCursorSpelling(cursor));
+    const CXCursor scope = clang_getCursorSemanticParent(cursor);
+    const auto scope_kind = clang_getCursorKind(scope);
+    if (scope_kind == CXCursor_ClassDecl || scope_kind == CXCursor_StructDecl ||
+        scope_kind == CXCursor_ClassTemplate) {
+        caller = spelling(clang_getCursorSpelling(scope)) + "::" + caller;
+    }
+    Walk w{*tls_sites, caller, 0};
+    clang_visitChildren(cursor, walk_body, &w);
+    return CXChildVisit_Continue;
+}
+
+// name of an entry func by id, the id if it's not one of them
+std::string name_of(const std::unordered_map<uint32_t, std::string> &names,
+                    uint32_t fid)
+{
+    const auto it = names.find(fid);
+    return it != names.end() ? it->second : "#" + std::to_string(fid);
+}
+
+}  // namespace
+
+std::vector<CrossingSite>
+find_crossing_sites(const std::string &file,
+                    const std::unordered_set<std::string> &callees)
+{
+    Sites sites{&callees, {}};
+    tls_sites = &sites;
+    FileContext f_ctx{.file_path = file};
+    parse_file(f_ctx, crossing_site_collect_visitor);
+    tls_sites = nullptr;
+    return std::move(sites.res);
+}
+
+bool read_crossing_counts(const std::string &path, CrossingCounts &counts)
+{
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string kind;
+        uint32_t a = 0, b = 0;
+        uint64_t n = 0;
+        fields >> kind;
+        if (kind == "ecall" || kind == "ocall") {
+            if (fields >> a >> n) {
+                counts.calls[a] += n;
+            }
+        }
+        else if (kind == "pair") {
+            if (fields >> a >> b >> n) {
+                counts.pairs[{a, b}] += n;
+            }
+        }
+    }
+    return true;
+}
+
+void write_boundary_report(const std::filesystem::path &path,
+                           const std::vector<CrossingSite> &ecall_sites,
+                           const std::vector<CrossingSite> &ocall_sites,
+                           const CrossingCounts &counts,
+                           const std::unordered_set<std::string> &ecalls,
+                           const std::unordered_set<std::string> &ocalls,
+                           const std::vector<std::string> &relocated)
+{
+    std::unordered_map<uint32_t, std::string> names;
+    for (const auto *world : {&ecalls, &ocalls}) {
+        for (const auto &name : *world) {
+            names[get_func_id(name)] = name;
+        }
+    }
+    const auto count_of = [&](const std::string &callee) -> uint64_t {
+        const auto it = counts.calls.find(get_func_id(callee));
+        return it != counts.calls.end() ? it->second : 0;
+    };
+
+    // one edge per caller and callee, with its deepest call
+    struct Edge
+    {
+        const CrossingSite *site;
+        const char *kind;
+        uint64_t count;
+    };
+    std::map<std::pair<std::string, std::string>, Edge> edges;
+    for (const auto &[sites, kind] :
+         {std::make_pair(&ecall_sites, "ecall"),
+          std::make_pair(&ocall_sites, "ocall")}) {
+        for (const auto &site : *sites) {
+            auto [it, added] = edges.try_emplace(
+                {site.caller, site.callee},
+                Edge{&site, kind, count_of(site.callee)});
+            if (!added && site.loop_depth > it->second.site->loop_depth) {
+                it->second.site = &site;
+            }
+        }
+    }
+    std::vector<Edge> ranked;
+    for (const auto &[key, edge] : edges) {
+        ranked.push_back(edge);
+    }
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const Edge &a, const Edge &b) {
+                         if (a.count != b.count) {
+                             return a.count > b.count;
+                         }
+                         return a.site->loop_depth > b.site->loop_depth;
+                     });
+
+    std::vector<std::pair<uint64_t, std::pair<uint32_t, uint32_t>>> pairs;
+    for (const auto &[pair, n] : counts.pairs) {
+        pairs.emplace_back(n, pair);
+    }
+    std::stable_sort(pairs.begin(), pairs.end(),
+                     [](const auto &a, const auto &b) {
+                         return a.first > b.first;
+                     });
+    if (pairs.size() > MAX_REPORTED) {
+        pairs.resize(MAX_REPORTED);
+    }
+
+    std::ofstream out(path);
+    ASSERT(out, "Unable to write %s", path.c_str());
+    out << "# cross-world edges, hottest first: crossings at runtime (- if "
+           "not counted), loops around the call, kind, caller -> callee, "
+           "call site\n";
+    for (const auto &e : ranked) {
+        out << (counts.calls.empty() ? "-" : std::to_string(e.count)) << "\t"
+            << e.site->loop_depth << "\t" << e.kind << "\t" << e.site->caller
+            << " -> " << e.site->callee << "\t" << e.site->location << "\n";
+    }
+
+    out << "\n# crossings made back to back: times, first, then\n";
+    for (const auto &[n, pair] : pairs) {
+        out << n << "\t" << name_of(names, pair.first) << "\t"
+            << name_of(names, pair.second) << "\n";
+    }
+
+    out << "\n# pure insecure funcs compiled into the enclave, their calls "
+           "don't cross\n";
+    for (const auto &name : relocated) {
+        out << name << "\n";
+    }
+
+    out << "\n# suggestions\n";
+    size_t suggested = 0;
+    for (const auto &e : ranked) {
+        if (suggested == MAX_REPORTED) {
+            break;
+        }
+        if (e.site->loop_depth == 0) {
+            continue;
+        }
+        out << e.site->caller << " crosses into " << e.site->callee
+            << " once per loop iteration at " << e.site->location
+            << ": take the loop across, e.g. with a " << e.site->callee
+            << "_batch entry func which gets the inputs of all iterations "
+               "at once\n";
+        ++suggested;
+    }
+    for (const auto &[n, pair] : pairs) {
+        if (suggested == MAX_REPORTED) {
+            break;
+        }
+        if (n < 2) {
+            continue;
+        }
+        const auto first = name_of(names, pair.first);
+        const auto then = name_of(names, pair.second);
+        if (pair.first == pair.second) {
+            out << first << " is called " << n
+                << " times back to back: batch the calls into one\n";
+        }
+        else if (ecalls.count(first) == ecalls.count(then)) {
+            out << first << " is followed by " << then << " " << n
+                << " times: fuse them into one entry func\n";
+        }
+        else {
+            // an ecall making an ocall or the other way around, fusing
+            // them changes nothing
+            continue;
+        }
+        ++suggested;
+    }
+    if (suggested == 0) {
+        out << "nothing to fuse\n";
+    }
+    DTEE_LOG("WROTE BOUNDARY REPORT %s: %zu EDGES, %zu SUGGESTIONS\n",
+             path.c_str(), ranked.size(), suggested);
+}
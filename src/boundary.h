@@ -0,0 +1,44 @@
+#pragma once
+#include <map>
+
+#include "pch.h"
+
+// a call from one world into an entry func of the other
+struct CrossingSite {
+  std::string caller;
+  std::string callee;
+  // file:line of the call
+  std::string location;
+  // loops around the call in the caller, such a call crosses once per
+  // iteration
+  unsigned loop_depth = 0;
+};
+
+/// @brief calls to any of callees in the function definitions of file
+std::vector<CrossingSite>
+find_crossing_sites(const std::string &file,
+                    const std::unordered_set<std::string> &callees);
+
+// what the host counted at runtime, by func id (see get_func_id)
+struct CrossingCounts {
+  std::unordered_map<uint32_t, uint64_t> calls;
+  // crossings which directly followed each other on a thread
+  std::map<std::pair<uint32_t, uint32_t>, uint64_t> pairs;
+};
+
+/// @brief read the counts a host wrote to $DTEE_CROSSING_COUNTS, false if
+/// the file can't be read
+bool read_crossing_counts(const std::string &path, CrossingCounts &counts);
+
+/// @brief write the boundary report: the cross-world edges, hottest first,
+/// the crossings most often made back to back, and which of them to fuse
+/// into one entry func. Without runtime counts, edges are ranked by the
+/// loops around their calls. relocated are the insecure funcs compiled into
+/// the enclave, whose calls no longer cross.
+void write_boundary_report(const std::filesystem::path &path,
+                           const std::vector<CrossingSite> &ecall_sites,
+                           const std::vector<CrossingSite> &ocall_sites,
+                           const CrossingCounts &counts,
+                           const std::unordered_set<std::string> &ecalls,
+                           const std::unordered_set<std::string> &ocalls,
+                           const std::vector<std::string> &relocated);
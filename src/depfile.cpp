@@ -0,0 +1,70 @@
+#include "depfile.h"
+
+#include <algorithm>
+
+namespace {
+
+// make syntax, which ninja's depfile parser understands too
+std::string escape(const std::string &path)
+{
+    std::string res;
+    for (const char c : path) {
+        if (c == ' ' || c == '#' || c == '\\') {
+            res += '\\';
+        }
+        else if (c == '$') {
+            res += '$';
+        }
+        res += c;
+    }
+    return res;
+}
+
+std::string absolute_path(const std::filesystem::path &p)
+{
+    return std::filesystem::absolute(p).lexically_normal().string();
+}
+
+}  // namespace
+
+void write_depfile(const std::filesystem::path &depfile,
+                   const std::filesystem::path &target,
+                   const std::vector<std::filesystem::path> &inputs)
+{
+    std::vector<std::string> deps;
+    for (const auto &p : inputs) {
+        deps.push_back(absolute_path(p));
+    }
+    std::sort(deps.begin(), deps.end());
+    deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+
+    if (depfile.has_parent_path()) {
+        std::filesystem::create_directories(depfile.parent_path());
+    }
+    std::ofstream out(depfile);
+    ASSERT(out, "Unable to write depfile: %s", depfile.c_str());
+    out << escape(absolute_path(target)) << ":";
+    for (const auto &dep : deps) {
+        out << " \\\n  " << escape(dep);
+    }
+    out << "\n";
+}
+
+void write_stamp(const std::filesystem::path &stamp,
+                 const std::vector<std::filesystem::path> &outputs)
+{
+    std::vector<std::string> lines;
+    for (const auto &p : outputs) {
+        lines.push_back(absolute_path(p));
+    }
+    std::sort(lines.begin(), lines.end());
+
+    if (stamp.has_parent_path()) {
+        std::filesystem::create_directories(stamp.parent_path());
+    }
+    std::ofstream out(stamp, std::ios::trunc);
+    ASSERT(out, "Unable to write stamp: %s", stamp.c_str());
+    for (const auto &line : lines) {
+        out << line << "\n";
+    }
+}
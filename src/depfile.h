@@ -0,0 +1,13 @@
+#pragma once
+#include "pch.h"
+
+/// @brief write a Makefile/Ninja style depfile with a single rule
+/// "target: inputs...", so the build system reruns the generator only when
+/// one of the inputs changed
+void write_depfile(const std::filesystem::path &depfile,
+                   const std::filesystem::path &target,
+                   const std::vector<std::filesystem::path> &inputs);
+
+/// @brief (re)write the stamp file, listing the outputs of the run
+void write_stamp(const std::filesystem::path &stamp,
+                 const std::vector<std::filesystem::path> &outputs);
@@ -1,4 +1,6 @@
 #pragma once
+#include <algorithm>
+
 #include "pch.h"
 #include "thread_pool.h"
 
@@ -21,6 +23,12 @@ inline bool is_source_file(const std::filesystem::path &p) {
          p.extension() == ".cc";
 }
 
+inline bool is_header_file(const std::filesystem::path &p) {
+  static const std::unordered_set<std::string> header_ext = {
+      ".h", ".hh", ".hpp", ".hxx", ".inc", ".ipp", ".tcc"};
+  return header_ext.count(p.extension().string()) != 0;
+}
+
 template <typename VISITOR>
 void for_each_in_dir(const std::filesystem::path &path, VISITOR visitor) {
   ASSERT(std::filesystem::is_directory(path), "%s not a directory",
@@ -95,3 +103,15 @@ void for_each_file_in_path_recursive_parallel(
     pool.enqueue([&visitor, entry] { visitor(entry); });
   });
 }
+
+// true if dir is path or one of its parents, symlinks and ".." resolved
+inline bool is_same_or_ancestor(const std::filesystem::path &dir,
+                                const std::filesystem::path &path) {
+  auto resolved = [](const std::filesystem::path &p) {
+    auto res = std::filesystem::weakly_canonical(std::filesystem::absolute(p));
+    return res.has_filename() ? res : res.parent_path();
+  };
+  const auto d = resolved(dir), p = resolved(path);
+  return std::mismatch(d.begin(), d.end(), p.begin(), p.end()).first ==
+         d.end();
+}
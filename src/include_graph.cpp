@@ -0,0 +1,252 @@
+#include "include_graph.h"
+
+#include <algorithm>
+#include <queue>
+
+#include "fs.h"
+
+namespace {
+
+struct IncludeDirective
+{
+    bool quoted;
+    // #include MACRO, can't be followed without preprocessing
+    bool computed;
+    std::string spelling;
+};
+
+bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+// a cheap line scanner, std::regex is far too slow for generated headers
+// holding megabytes of array data
+std::vector<IncludeDirective> scan_includes(const std::string &content)
+{
+    std::vector<IncludeDirective> res;
+    const size_t n = content.size();
+    size_t pos = 0;
+    while (pos < n) {
+        size_t eol = content.find('\n', pos);
+        if (eol == std::string::npos) {
+            eol = n;
+        }
+
+        size_t i = pos;
+        while (i < eol && is_blank(content[i])) ++i;
+        if (i < eol && content[i] == '#') {
+            ++i;
+            while (i < eol && is_blank(content[i])) ++i;
+            if (content.compare(i, 7, "include") == 0) {
+                i += 7;
+                if (content.compare(i, 5, "_next") == 0) {
+                    i += 5;
+                }
+                while (i < eol && is_blank(content[i])) ++i;
+                if (i < eol && (content[i] == '"' || content[i] == '<')) {
+                    const char close = content[i] == '"' ? '"' : '>';
+                    const size_t end = content.find(close, i + 1);
+                    if (end != std::string::npos && end < eol) {
+                        res.push_back({close == '"', false,
+                                       content.substr(i + 1, end - i - 1)});
+                    }
+                }
+                else if (i < eol &&
+                         (isalpha(content[i]) || content[i] == '_')) {
+                    res.push_back({false, true, ""});
+                }
+            }
+        }
+        pos = eol + 1;
+    }
+    return res;
+}
+
+// "../a/./b.h" -> "a/b.h", a path suffix usable for matching
+std::string strip_relative_prefix(const std::filesystem::path &spelling)
+{
+    std::filesystem::path res;
+    bool leading = true;
+    for (const auto &part : spelling.lexically_normal()) {
+        if (leading && (part == ".." || part == ".")) {
+            continue;
+        }
+        leading = false;
+        res /= part;
+    }
+    return res.generic_string();
+}
+
+}  // namespace
+
+IncludeGraph::IncludeGraph(
+    const std::vector<std::filesystem::path> &search_roots)
+{
+    for (const auto &root : search_roots) {
+        if (!std::filesystem::is_directory(root)) {
+            continue;
+        }
+        for_each_file_in_path_recursive(root, [&](const auto &f) {
+            const auto p = f.path().lexically_normal();
+            if (known_.insert(p.string()).second) {
+                by_filename_[p.filename().string()].push_back(p.string());
+            }
+        });
+    }
+}
+
+const IncludeGraph::Node &IncludeGraph::node(const std::string &file)
+{
+    const auto cached = nodes_.find(file);
+    if (cached != nodes_.end()) {
+        return cached->second;
+    }
+
+    Node res;
+    const std::filesystem::path path(file);
+    for (const auto &inc : scan_includes(read_file(file))) {
+        if (inc.computed) {
+            DTEE_LOG_DEBUG("COMPUTED INCLUDE IN %s\n", file.c_str());
+            res.computed = true;
+            continue;
+        }
+
+        if (inc.quoted) {
+            const auto local =
+                (path.parent_path() / inc.spelling).lexically_normal();
+            if (known_.count(local.string()) != 0 ||
+                std::filesystem::exists(local)) {
+                res.includes.push_back(local.string());
+                continue;
+            }
+        }
+
+        const std::filesystem::path spelling(inc.spelling);
+        const auto suffix = "/" + strip_relative_prefix(spelling);
+        const auto it = by_filename_.find(spelling.filename().string());
+        if (it == by_filename_.end()) {
+            // a system or SDK header
+            continue;
+        }
+        for (const auto &candidate : it->second) {
+            const bool match =
+                candidate.size() >= suffix.size() &&
+                candidate.compare(candidate.size() - suffix.size(),
+                                  suffix.size(), suffix) == 0;
+            if (match) {
+                res.include_dirs.push_back(
+                    candidate.substr(0, candidate.size() - suffix.size()));
+            }
+            else if (candidate == suffix.substr(1)) {
+                res.include_dirs.push_back(".");
+            }
+            else {
+                continue;
+            }
+            res.includes.push_back(candidate);
+        }
+    }
+    return nodes_.emplace(file, std::move(res)).first->second;
+}
+
+const std::vector<std::string> &
+IncludeGraph::includes_of(const std::string &file)
+{
+    return node(file).includes;
+}
+
+IncludeClosure
+IncludeGraph::closure(const std::vector<std::filesystem::path> &seeds)
+{
+    IncludeClosure closure;
+    std::queue<std::string> pending;
+    for (const auto &seed : seeds) {
+        const auto p = seed.lexically_normal().string();
+        if (closure.files.insert(p).second) {
+            pending.push(p);
+        }
+    }
+
+    while (!pending.empty()) {
+        const Node &n = node(pending.front());
+        pending.pop();
+        if (n.computed) {
+            closure.complete = false;
+        }
+        closure.include_dirs.insert(n.include_dirs.begin(),
+                                    n.include_dirs.end());
+        for (const auto &inc : n.includes) {
+            if (closure.files.insert(inc).second) {
+                pending.push(inc);
+            }
+        }
+    }
+    return closure;
+}
+
+size_t IncludeGraph::closure_bytes(const IncludeClosure &closure)
+{
+    size_t res = 0;
+    for (const auto &f : closure.files) {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(f, ec);
+        if (!ec) {
+            res += size;
+        }
+    }
+    return res;
+}
+
+IncludeClosure
+collect_include_closure(const std::vector<std::filesystem::path> &seeds,
+                        const std::vector<std::filesystem::path> &search_roots)
+{
+    return IncludeGraph(search_roots).closure(seeds);
+}
+
+std::vector<std::string>
+choose_precompiled_headers(IncludeGraph &graph,
+                           const std::vector<std::filesystem::path> &sources,
+                           size_t min_bytes, size_t max_headers)
+{
+    // header -> number of sources including it directly
+    std::unordered_map<std::string, size_t> users;
+    for (const auto &src : sources) {
+        std::unordered_set<std::string> direct;
+        for (const auto &inc : graph.includes_of(src.lexically_normal())) {
+            if (is_header_file(inc) && direct.insert(inc).second) {
+                ++users[inc];
+            }
+        }
+    }
+
+    std::vector<std::pair<size_t, std::string>> candidates;
+    for (const auto &[header, count] : users) {
+        if (count < 2 || count * 2 < sources.size()) {
+            continue;
+        }
+        const auto closure = graph.closure({header});
+        // a header that can't be fully followed may depend on macros the
+        // including source defines first, keep it out of the pch
+        if (!closure.complete) {
+            continue;
+        }
+        const size_t bytes = IncludeGraph::closure_bytes(closure);
+        if (bytes >= min_bytes) {
+            candidates.emplace_back(bytes, header);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const auto &a, const auto &b) {
+                  return a.first != b.first ? a.first > b.first
+                                            : a.second < b.second;
+              });
+
+    std::vector<std::string> res;
+    for (const auto &[bytes, header] : candidates) {
+        if (res.size() >= max_headers) {
+            break;
+        }
+        DTEE_LOG_DEBUG("PRECOMPILE %s (%zu bytes)\n", header.c_str(), bytes);
+        res.push_back(header);
+    }
+    return res;
+}
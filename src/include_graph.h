@@ -0,0 +1,68 @@
+#pragma once
+#include <set>
+
+#include "pch.h"
+
+struct IncludeClosure {
+  // false if some include could not be followed (e.g. #include MACRO), then
+  // the closure is not trustworthy and nothing should be pruned
+  bool complete = true;
+  // normalized paths of the project files reachable from the seeds,
+  // including the seeds
+  std::unordered_set<std::string> files;
+  // directories the includes not next to their includer were resolved
+  // against, i.e. what a compiler needs on its include path
+  std::set<std::string> include_dirs;
+};
+
+/// @brief textual include graph over the files of some directories. Files are
+/// scanned once and their resolved includes cached, so many closures can be
+/// queried cheaply. Not thread safe.
+///
+/// Includes are followed regardless of #if, and an include that doesn't
+/// resolve next to the includer matches every known file with that path
+/// suffix, so closures over-approximate what any compiler configuration
+/// would read.
+class IncludeGraph {
+public:
+  /// @param search_roots directories whose files can be reached by includes
+  explicit IncludeGraph(const std::vector<std::filesystem::path> &search_roots);
+
+  /// @brief compute the files transitively included by seeds
+  /// @param seeds source files to start from
+  IncludeClosure closure(const std::vector<std::filesystem::path> &seeds);
+
+  /// @brief files directly included by file
+  const std::vector<std::string> &includes_of(const std::string &file);
+
+  /// @brief total size in bytes of the files in closure
+  static size_t closure_bytes(const IncludeClosure &closure);
+
+private:
+  struct Node {
+    bool computed = false;
+    std::vector<std::string> includes;
+    std::vector<std::string> include_dirs;
+  };
+  const Node &node(const std::string &file);
+
+  // filename -> files with that name, to resolve includes found through
+  // include directories we don't know about
+  std::unordered_map<std::string, std::vector<std::string>> by_filename_;
+  std::unordered_set<std::string> known_;
+  std::unordered_map<std::string, Node> nodes_;
+};
+
+/// @brief compute the files of the project transitively included by seeds,
+/// see IncludeGraph
+IncludeClosure
+collect_include_closure(const std::vector<std::filesystem::path> &seeds,
+                        const std::vector<std::filesystem::path> &search_roots);
+
+/// @brief pick headers worth precompiling for a target built from sources:
+/// headers directly included by at least half of them (and at least two),
+/// pulling in at least min_bytes, heaviest first
+std::vector<std::string>
+choose_precompiled_headers(IncludeGraph &graph,
+                           const std::vector<std::filesystem::path> &sources,
+                           size_t min_bytes = 64 * 1024, size_t max_headers = 8);
@@ -0,0 +1,39 @@
+#define DTEE_LIBCLANG_LOADER
+#include "libclang.h"
+
+#include <dlfcn.h>
+
+#include "pch.h"
+
+#ifndef DTEE_LIBCLANG_PATH
+#define DTEE_LIBCLANG_PATH "libclang.so"
+#endif
+
+namespace {
+
+LibClang load()
+{
+    const char *path = getenv("DTEEGEN_LIBCLANG");
+    if (path == nullptr || *path == '\0') {
+        path = DTEE_LIBCLANG_PATH;
+    }
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    ASSERT(handle != nullptr, "Unable to load libclang: %s", dlerror());
+    DTEE_LOG_DEBUG("LOADED %s\n", path);
+
+    LibClang table;
+#define DTEE_LIBCLANG_RESOLVE(name)                                            \
+    table.name = reinterpret_cast<decltype(table.name)>(dlsym(handle, #name)); \
+    ASSERT(table.name != nullptr, "%s: missing %s", path, #name);
+    DTEE_LIBCLANG_FUNCTIONS(DTEE_LIBCLANG_RESOLVE)
+#undef DTEE_LIBCLANG_RESOLVE
+    return table;
+}
+
+}  // namespace
+
+const LibClang &libclang()
+{
+    static const LibClang table = load();
+    return table;
+}
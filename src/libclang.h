@@ -0,0 +1,142 @@
+#pragma once
+// libclang is huge, and most invocations (create, --help) never parse
+// anything. With DTEE_LAZY_LIBCLANG it isn't linked, but dlopen()ed the
+// first time a clang_* function is called, through the table below. Include
+// this after the clang-c headers in every file calling libclang.
+#include <clang-c/CXString.h>
+#include <clang-c/Index.h>
+
+// every libclang function dteegen calls
+#define DTEE_LIBCLANG_FUNCTIONS(X)                                             \
+  X(clang_Cursor_getArgument)                                                  \
+  X(clang_Cursor_getMangling)                                                  \
+  X(clang_Cursor_getNumArguments)                                              \
+  X(clang_Cursor_getStorageClass)                                              \
+  X(clang_Cursor_getTranslationUnit)                                           \
+  X(clang_Cursor_isNull)                                                       \
+  X(clang_Cursor_isVariadic)                                                   \
+  X(clang_Location_isFromMainFile)                                             \
+  X(clang_Location_isInSystemHeader)                                           \
+  X(clang_Type_getSizeOf)                                                      \
+  X(clang_createIndex)                                                         \
+  X(clang_disposeDiagnostic)                                                   \
+  X(clang_disposeIndex)                                                        \
+  X(clang_disposeString)                                                       \
+  X(clang_disposeTokens)                                                       \
+  X(clang_disposeTranslationUnit)                                              \
+  X(clang_equalCursors)                                                        \
+  X(clang_getArrayElementType)                                                 \
+  X(clang_getArraySize)                                                        \
+  X(clang_getCString)                                                          \
+  X(clang_getCanonicalCursor)                                                  \
+  X(clang_getCanonicalType)                                                    \
+  X(clang_getCursorDefinition)                                                 \
+  X(clang_getCursorExtent)                                                     \
+  X(clang_getCursorKind)                                                       \
+  X(clang_getCursorLinkage)                                                    \
+  X(clang_getCursorLocation)                                                   \
+  X(clang_getCursorReferenced)                                                 \
+  X(clang_getCursorResultType)                                                 \
+  X(clang_getCursorSemanticParent)                                             \
+  X(clang_getCursorSpelling)                                                   \
+  X(clang_getCursorType)                                                       \
+  X(clang_getDiagnostic)                                                       \
+  X(clang_getDiagnosticLocation)                                               \
+  X(clang_getDiagnosticSeverity)                                               \
+  X(clang_getFileName)                                                         \
+  X(clang_getInclusions)                                                       \
+  X(clang_getNumDiagnostics)                                                   \
+  X(clang_getNullCursor)                                                       \
+  X(clang_getPointeeType)                                                      \
+  X(clang_getRangeEnd)                                                         \
+  X(clang_getRangeStart)                                                       \
+  X(clang_getResultType)                                                       \
+  X(clang_getSpellingLocation)                                                 \
+  X(clang_getTokenExtent)                                                      \
+  X(clang_getTokenKind)                                                        \
+  X(clang_getTokenSpelling)                                                    \
+  X(clang_getTranslationUnitCursor)                                            \
+  X(clang_getTypeDeclaration)                                                  \
+  X(clang_getTypeSpelling)                                                     \
+  X(clang_isConstQualifiedType)                                                \
+  X(clang_isCursorDefinition)                                                  \
+  X(clang_isInvalidDeclaration)                                                \
+  X(clang_isPODType)                                                           \
+  X(clang_parseTranslationUnit)                                                \
+  X(clang_tokenize)                                                            \
+  X(clang_visitChildren)
+
+#ifdef DTEE_LAZY_LIBCLANG
+
+struct LibClang {
+#define DTEE_LIBCLANG_MEMBER(name) decltype(&::name) name;
+  DTEE_LIBCLANG_FUNCTIONS(DTEE_LIBCLANG_MEMBER)
+#undef DTEE_LIBCLANG_MEMBER
+};
+
+/// @brief the function table, loading libclang on first call. Exits if it
+/// can't be loaded. $DTEEGEN_LIBCLANG overrides the library found at build
+/// time.
+const LibClang &libclang();
+
+#ifndef DTEE_LIBCLANG_LOADER
+#define clang_Cursor_getArgument libclang().clang_Cursor_getArgument
+#define clang_Cursor_getMangling libclang().clang_Cursor_getMangling
+#define clang_Cursor_getNumArguments libclang().clang_Cursor_getNumArguments
+#define clang_Cursor_getStorageClass libclang().clang_Cursor_getStorageClass
+#define clang_Cursor_getTranslationUnit libclang().clang_Cursor_getTranslationUnit
+#define clang_Cursor_isNull libclang().clang_Cursor_isNull
+#define clang_Cursor_isVariadic libclang().clang_Cursor_isVariadic
+#define clang_Location_isFromMainFile libclang().clang_Location_isFromMainFile
+#define clang_Location_isInSystemHeader libclang().clang_Location_isInSystemHeader
+#define clang_Type_getSizeOf libclang().clang_Type_getSizeOf
+#define clang_createIndex libclang().clang_createIndex
+#define clang_disposeDiagnostic libclang().clang_disposeDiagnostic
+#define clang_disposeIndex libclang().clang_disposeIndex
+#define clang_disposeString libclang().clang_disposeString
+#define clang_disposeTokens libclang().clang_disposeTokens
+#define clang_disposeTranslationUnit libclang().clang_disposeTranslationUnit
+#define clang_equalCursors libclang().clang_equalCursors
+#define clang_getArrayElementType libclang().clang_getArrayElementType
+#define clang_getArraySize libclang().clang_getArraySize
+#define clang_getCString libclang().clang_getCString
+#define clang_getCanonicalCursor libclang().clang_getCanonicalCursor
+#define clang_getCanonicalType libclang().clang_getCanonicalType
+#define clang_getCursorDefinition libclang().clang_getCursorDefinition
+#define clang_getCursorExtent libclang().clang_getCursorExtent
+#define clang_getCursorKind libclang().clang_getCursorKind
+#define clang_getCursorLinkage libclang().clang_getCursorLinkage
+#define clang_getCursorLocation libclang().clang_getCursorLocation
+#define clang_getCursorReferenced libclang().clang_getCursorReferenced
+#define clang_getCursorResultType libclang().clang_getCursorResultType
+#define clang_getCursorSemanticParent libclang().clang_getCursorSemanticParent
+#define clang_getCursorSpelling libclang().clang_getCursorSpelling
+#define clang_getCursorType libclang().clang_getCursorType
+#define clang_getDiagnostic libclang().clang_getDiagnostic
+#define clang_getDiagnosticLocation libclang().clang_getDiagnosticLocation
+#define clang_getDiagnosticSeverity libclang().clang_getDiagnosticSeverity
+#define clang_getFileName libclang().clang_getFileName
+#define clang_getInclusions libclang().clang_getInclusions
+#define clang_getNumDiagnostics libclang().clang_getNumDiagnostics
+#define clang_getNullCursor libclang().clang_getNullCursor
+#define clang_getPointeeType libclang().clang_getPointeeType
+#define clang_getRangeEnd libclang().clang_getRangeEnd
+#define clang_getRangeStart libclang().clang_getRangeStart
+#define clang_getResultType libclang().clang_getResultType
+#define clang_getSpellingLocation libclang().clang_getSpellingLocation
+#define clang_getTokenExtent libclang().clang_getTokenExtent
+#define clang_getTokenKind libclang().clang_getTokenKind
+#define clang_getTokenSpelling libclang().clang_getTokenSpelling
+#define clang_getTranslationUnitCursor libclang().clang_getTranslationUnitCursor
+#define clang_getTypeDeclaration libclang().clang_getTypeDeclaration
+#define clang_getTypeSpelling libclang().clang_getTypeSpelling
+#define clang_isConstQualifiedType libclang().clang_isConstQualifiedType
+#define clang_isCursorDefinition libclang().clang_isCursorDefinition
+#define clang_isInvalidDeclaration libclang().clang_isInvalidDeclaration
+#define clang_isPODType libclang().clang_isPODType
+#define clang_parseTranslationUnit libclang().clang_parseTranslationUnit
+#define clang_tokenize libclang().clang_tokenize
+#define clang_visitChildren libclang().clang_visitChildren
+#endif
+
+#endif
@@ -0,0 +1,216 @@
+#include "log.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dtee_log {
+
+namespace {
+
+constexpr size_t RECORD_MSG_SIZE = 496;
+constexpr size_t RING_SIZE = 1024;
+constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(20);
+
+struct Record
+{
+    uint64_t seq;
+    Level level;
+    uint16_t len;
+    char msg[RECORD_MSG_SIZE];
+};
+
+// single producer (the owner thread), single consumer (whoever holds
+// drain_mutex). head is only written by the producer, tail by the consumer.
+struct Ring
+{
+    std::array<Record, RING_SIZE> records;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+};
+
+class Logger
+{
+public:
+    Logger()
+    {
+        drainer_ = std::thread([this] {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            while (!stop_) {
+                wake_.wait_for(lock, DRAIN_INTERVAL);
+                lock.unlock();
+                drain();
+                lock.lock();
+            }
+        });
+        // the logger is never destroyed, so that threads still logging
+        // during exit don't touch a dead ring. Just stop the drainer.
+        std::atexit([] { instance().shutdown(); });
+    }
+
+    static Logger &instance()
+    {
+        static Logger *logger = new Logger;
+        return *logger;
+    }
+
+    Ring &local_ring()
+    {
+        thread_local Ring *ring = nullptr;
+        if (ring == nullptr) {
+            auto owned = std::make_unique<Ring>();
+            ring = owned.get();
+            std::scoped_lock<std::mutex> lock(rings_mutex_);
+            rings_.push_back(std::move(owned));
+        }
+        return *ring;
+    }
+
+    void wake() { wake_.notify_one(); }
+
+    bool stopped() const { return stopped_.load(std::memory_order_acquire); }
+
+    uint64_t next_seq() { return seq_.fetch_add(1, std::memory_order_relaxed); }
+
+    void drain()
+    {
+        std::scoped_lock<std::mutex> drain_lock(drain_mutex_);
+
+        batch_.clear();
+        {
+            std::scoped_lock<std::mutex> lock(rings_mutex_);
+            for (const auto &ring : rings_) {
+                const size_t tail = ring->tail.load(std::memory_order_relaxed);
+                const size_t head = ring->head.load(std::memory_order_acquire);
+                for (size_t i = tail; i != head; ++i) {
+                    batch_.push_back(&ring->records[i % RING_SIZE]);
+                }
+                cursors_.emplace_back(ring.get(), head);
+            }
+        }
+        if (batch_.empty()) {
+            cursors_.clear();
+            return;
+        }
+
+        // threads log concurrently, restore the global order
+        std::sort(batch_.begin(), batch_.end(),
+                  [](const Record *a, const Record *b) { return a->seq < b->seq; });
+        bool has_err = false;
+        for (const Record *r : batch_) {
+            has_err |= emit(*r);
+        }
+        fflush(stdout);
+        if (has_err) {
+            fflush(stderr);
+        }
+
+        for (auto &[ring, head] : cursors_) {
+            ring->tail.store(head, std::memory_order_release);
+        }
+        cursors_.clear();
+    }
+
+    static bool emit(const Record &r)
+    {
+        const bool is_err = r.level >= Level::Warn;
+        fwrite(r.msg, 1, r.len, is_err ? stderr : stdout);
+        return is_err;
+    }
+
+private:
+    void shutdown()
+    {
+        {
+            std::scoped_lock<std::mutex> lock(wake_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        if (drainer_.joinable() &&
+            drainer_.get_id() != std::this_thread::get_id()) {
+            drainer_.join();
+        }
+        stopped_.store(true, std::memory_order_release);
+        drain();
+    }
+
+    std::thread drainer_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::atomic<bool> stopped_{false};
+    std::atomic<uint64_t> seq_{0};
+
+    std::mutex rings_mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+
+    // only touched with drain_mutex_ held
+    std::mutex drain_mutex_;
+    std::vector<const Record *> batch_;
+    std::vector<std::pair<Ring *, size_t>> cursors_;
+};
+
+void format(Record &r, const char *fmt, va_list ap)
+{
+    int n = vsnprintf(r.msg, sizeof(r.msg), fmt, ap);
+    if (n < 0) {
+        n = 0;
+    }
+    if (static_cast<size_t>(n) >= sizeof(r.msg)) {
+        // truncated, keep the line terminated
+        n = sizeof(r.msg) - 1;
+        r.msg[n - 4] = r.msg[n - 3] = r.msg[n - 2] = '.';
+        r.msg[n - 1] = '\n';
+    }
+    r.len = static_cast<uint16_t>(n);
+}
+
+} // namespace
+
+void write(Level level, const char *fmt, ...)
+{
+    Logger &logger = Logger::instance();
+    va_list ap;
+    va_start(ap, fmt);
+
+    Ring &ring = logger.local_ring();
+    const size_t head = ring.head.load(std::memory_order_relaxed);
+    while (!logger.stopped() &&
+           head - ring.tail.load(std::memory_order_acquire) >= RING_SIZE) {
+        logger.wake();
+        std::this_thread::yield();
+    }
+
+    if (logger.stopped()) {
+        // exiting, nobody drains the rings any more
+        Record r;
+        r.level = level;
+        format(r, fmt, ap);
+        va_end(ap);
+        Logger::emit(r);
+        return;
+    }
+
+    Record &r = ring.records[head % RING_SIZE];
+    r.level = level;
+    r.seq = logger.next_seq();
+    format(r, fmt, ap);
+    va_end(ap);
+    ring.head.store(head + 1, std::memory_order_release);
+
+    if (head - ring.tail.load(std::memory_order_relaxed) >= RING_SIZE / 2) {
+        logger.wake();
+    }
+}
+
+void flush() { Logger::instance().drain(); }
+
+} // namespace dtee_log
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// log levels, the lower the more verbose
+#define DTEE_LOG_LEVEL_TRACE 0
+#define DTEE_LOG_LEVEL_DEBUG 1
+#define DTEE_LOG_LEVEL_INFO 2
+#define DTEE_LOG_LEVEL_WARN 3
+#define DTEE_LOG_LEVEL_ERROR 4
+#define DTEE_LOG_LEVEL_OFF 5
+
+// logs below this level are compiled out entirely
+#ifndef DTEE_LOG_ACTIVE_LEVEL
+#define DTEE_LOG_ACTIVE_LEVEL DTEE_LOG_LEVEL_TRACE
+#endif
+
+namespace dtee_log {
+
+enum class Level : uint8_t {
+  Trace = DTEE_LOG_LEVEL_TRACE,
+  Debug = DTEE_LOG_LEVEL_DEBUG,
+  Info = DTEE_LOG_LEVEL_INFO,
+  Warn = DTEE_LOG_LEVEL_WARN,
+  Error = DTEE_LOG_LEVEL_ERROR,
+  Off = DTEE_LOG_LEVEL_OFF
+};
+
+inline std::atomic<Level> g_runtime_level{Level::Info};
+
+inline bool enabled(Level level) {
+  return level >= g_runtime_level.load(std::memory_order_relaxed);
+}
+
+inline void set_level(Level level) {
+  g_runtime_level.store(level, std::memory_order_relaxed);
+}
+
+/// @brief format the message into the ring buffer of the calling thread. The
+/// background thread will write it to stdout (stderr for warn and error).
+void write(Level level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/// @brief synchronously write out everything logged so far
+void flush();
+
+} // namespace dtee_log
+
+#define DTEE_LOG_AT(level, ...)                                                \
+  do {                                                                         \
+    if (dtee_log::enabled(level)) {                                            \
+      dtee_log::write(level, __VA_ARGS__);                                     \
+    }                                                                          \
+  } while (0)
+
+#if DTEE_LOG_ACTIVE_LEVEL <= DTEE_LOG_LEVEL_TRACE
+#define DTEE_LOG_TRACE(...) DTEE_LOG_AT(dtee_log::Level::Trace, __VA_ARGS__)
+#else
+#define DTEE_LOG_TRACE(...) ((void)0)
+#endif
+
+#if DTEE_LOG_ACTIVE_LEVEL <= DTEE_LOG_LEVEL_DEBUG
+#define DTEE_LOG_DEBUG(...) DTEE_LOG_AT(dtee_log::Level::Debug, __VA_ARGS__)
+#else
+#define DTEE_LOG_DEBUG(...) ((void)0)
+#endif
+
+#if DTEE_LOG_ACTIVE_LEVEL <= DTEE_LOG_LEVEL_INFO
+#define DTEE_LOG_INFO(...) DTEE_LOG_AT(dtee_log::Level::Info, __VA_ARGS__)
+#else
+#define DTEE_LOG_INFO(...) ((void)0)
+#endif
+
+#if DTEE_LOG_ACTIVE_LEVEL <= DTEE_LOG_LEVEL_WARN
+#define DTEE_LOG_WARN(...) DTEE_LOG_AT(dtee_log::Level::Warn, __VA_ARGS__)
+#else
+#define DTEE_LOG_WARN(...) ((void)0)
+#endif
+
+#define DTEE_LOG_ERROR(...) DTEE_LOG_AT(dtee_log::Level::Error, __VA_ARGS__)
+
+#define DTEE_LOG(...) DTEE_LOG_INFO(__VA_ARGS__)
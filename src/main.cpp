@@ -1,9 +1,16 @@
 #include <filesystem>
 
+#include "assets.h"
+#include "boundary.h"
+#include "depfile.h"
 #include "fs.h"
+#include "include_graph.h"
 #include "parser.h"
+#include "parse_worker.h"
 #include "pch.h"
 #include "pipe/cmake_transform.h"
+#include "purity.h"
+#include "reachability.h"
 #include "template.h"
 
 const auto relative_path(const std::string &path, const std::string &base)
@@ -18,14 +25,459 @@ const auto relative_path(const std::string &path, const std::string &base)
 #define PROJECT_TEMPLATE_PATH (TEMPLATE "/project_template")
 #define TEMPLATE_PROJECT_PATH (TEMPLATE "/template_project")
 #define TEE_CAPABILITY_PATH (TEMPLATE "/TEE-Capability")
+#define UNITY_DIR "unity"
+#define STAMP_FILE "dteegen.stamp"
+
+// project templates rendered last, they describe the generated trees which
+// are only complete then
+const std::set<std::string> LATE_PROJECT_TEMPLATES = {
+    "enclave_template.cmake", "function_cmake_secure.template"};
+
+// logs the wall time of each phase of a conversion, scripts/bench_convert.py
+// picks the "PHASE" lines up
+class PhaseTimer
+{
+   public:
+    explicit PhaseTimer(const char *name)
+        : name_(name), start_(std::chrono::steady_clock::now())
+    {
+    }
+    ~PhaseTimer() { end(); }
+
+    void next(const char *name)
+    {
+        end();
+        name_ = name;
+        start_ = std::chrono::steady_clock::now();
+    }
+
+   private:
+    void end()
+    {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count();
+        DTEE_LOG("PHASE %s: %lldms\n", name_, static_cast<long long>(ms));
+    }
+
+    const char *name_;
+    std::chrono::steady_clock::time_point start_;
+};
 
 constexpr auto SKIP_COPY_OPTION = std::filesystem::copy_options::skip_existing;
 constexpr auto DIRECTORY_COPY_OPTION =
     std::filesystem::copy_options::recursive |
     std::filesystem::copy_options::overwrite_existing;
-void generate_secgear(const std::filesystem::path project_root)
+struct ConvertOptions
+{
+    size_t jobs = POOL_SIZE;
+    // number of unity sources each secure target is merged into, 0 disables
+    // unity builds
+    size_t unity_groups = 0;
+    // precompile the headers most sources of a secure target include
+    bool pch = false;
+    // depfile listing everything the conversion read, for build systems
+    std::string depfile;
+    // touched after each successful conversion, listing its outputs.
+    // generated/dteegen.stamp if only the depfile is asked for
+    std::string stamp;
+    // parse in this many worker processes instead of the thread pool, 0
+    // parses in process
+    size_t workers = 0;
+    // address space cap of each parse worker in MiB, 0 for none
+    size_t worker_mem_mb = 0;
+    // times a file is retried after its parse worker died
+    size_t worker_retries = 1;
+    // seconds a parse worker may spend on a file before it's killed, 0 for
+    // no limit
+    size_t worker_timeout_s = 600;
+    // build only the enclave sources the entry funcs reach by name. Funcs
+    // reached through pointers, vtables or dlsym aren't seen, so it's opt-in,
+    // -ffunction-sections and --gc-sections drop dead code anyway
+    bool prune_unreachable = false;
+    // default build profile of the generated enclave, see
+    // enclave_template.cmake
+    std::string build_profile = "Release";
+    // keep pure insecure entry funcs ocalls instead of compiling them into
+    // the enclave
+    bool keep_ocalls = false;
+    // where to write the cross-world edges and which to fuse, empty for no
+    // report
+    std::string boundary_report;
+    // crossings a host counted at runtime ($DTEE_CROSSING_COUNTS), ranks the
+    // edges of the report
+    std::string crossing_counts;
+    // host threads which may run enclave threads besides the caller, see
+    // z_threads.h. 0, the default, keeps the enclave single threaded
+    size_t enclave_threads = 0;
+};
+
+// split sources (relative to root) into n groups of about the same total
+// size, biggest first into the smallest group so far
+std::vector<std::vector<std::string>>
+balance_unity_groups(const std::filesystem::path &root,
+                     const std::vector<std::string> &sources, size_t n)
+{
+    std::vector<std::pair<uintmax_t, std::string>> sized;
+    for (const auto &src : sources) {
+        sized.emplace_back(std::filesystem::file_size(root / src), src);
+    }
+    std::sort(sized.begin(), sized.end(), [](const auto &a, const auto &b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+
+    std::vector<std::vector<std::string>> groups(n);
+    std::vector<uintmax_t> group_size(n, 0);
+    for (const auto &[size, src] : sized) {
+        const auto smallest = std::distance(
+            group_size.begin(),
+            std::min_element(group_size.begin(), group_size.end()));
+        groups[smallest].push_back(src);
+        group_size[smallest] += size;
+    }
+    for (auto &g : groups) {
+        std::sort(g.begin(), g.end());
+    }
+    return groups;
+}
+
+// enclave build profile named on the command line, as CMake knows it
+std::string build_profile_name(const std::string &name)
+{
+    static const std::unordered_map<std::string, std::string> PROFILES = {
+        {"release", "Release"},
+        {"debug", "Debug"},
+        {"pgo-generate", "PGO_GENERATE"},
+        {"pgo-use", "PGO_USE"},
+    };
+    const auto it = PROFILES.find(name);
+    ASSERT(it != PROFILES.end(),
+           "Unknown build profile %s, use release, debug, pgo-generate or "
+           "pgo-use",
+           name.c_str());
+    return it->second;
+}
+
+// the symbols of the enclave sources (relative to generated_enclave), by
+// their path in generated_enclave
+std::unordered_map<std::string, TuSymbols>
+collect_enclave_symbols(const std::filesystem::path &generated_enclave,
+                        const std::vector<std::string> &sources,
+                        ThreadPool &pool, ParseWorkerPool *workers)
+{
+    std::vector<std::string> files;
+    for (const auto &src : sources) {
+        files.push_back((generated_enclave / src).string());
+    }
+    std::unordered_map<std::string, TuSymbols> symbols;
+    if (workers != nullptr) {
+        workers->run(ParseRequest::Symbols, files,
+                     [&](const std::string &file, FileSummary &&s) {
+                         symbols[file] = std::move(s.symbols);
+                     });
+    }
+    else {
+        std::mutex symbols_mutex;
+        for (const auto &file : files) {
+            pool.enqueue([&, file] {
+                TuSymbols s;
+                if (collect_symbols(file, s)) {
+                    std::scoped_lock<std::mutex> lock(symbols_mutex);
+                    symbols[file] = std::move(s);
+                }
+            });
+        }
+        pool.wait_queue_empty();
+    }
+    return symbols;
+}
+
+// drop the enclave sources (relative to generated_enclave) no entry func
+// reaches. The sources the templates generated without a project file behind
+// them (the dispatcher, ecdh) are the roots, the dispatch table reaches the
+// entry funcs. The files stay in the tree, they're just not compiled.
+void prune_unreachable_sources(
+    const std::filesystem::path &project_root,
+    const std::filesystem::path &generated_enclave,
+    std::vector<std::string> &sources,
+    const std::unordered_map<std::string, TuSymbols> &symbols)
+{
+    std::vector<std::string> files;
+    std::unordered_set<std::string> roots;
+    for (const auto &src : sources) {
+        files.push_back((generated_enclave / src).string());
+        if (!std::filesystem::exists(project_root / src)) {
+            roots.insert(files.back());
+        }
+    }
+
+    const auto unreachable = find_unreachable_units(files, symbols, roots);
+    const std::unordered_set<std::string> pruned(unreachable.begin(),
+                                                 unreachable.end());
+    uintmax_t total_bytes = 0, pruned_bytes = 0;
+    std::vector<std::string> kept;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        const auto size = std::filesystem::file_size(files[i]);
+        total_bytes += size;
+        if (pruned.count(files[i]) != 0) {
+            pruned_bytes += size;
+            DTEE_LOG_DEBUG("PRUNED UNREACHABLE ENCLAVE SOURCE: %s\n",
+                           sources[i].c_str());
+        }
+        else {
+            kept.push_back(sources[i]);
+        }
+    }
+    DTEE_LOG("PRUNED %zu OF %zu ENCLAVE SOURCES (%ju OF %ju BYTES)\n",
+             pruned.size(), sources.size(), pruned_bytes, total_bytes);
+    sources = std::move(kept);
+}
+
+// text has the identifier name, not as part of a longer one
+bool mentions(const std::string &text, const std::string &name)
+{
+    const auto is_identifier = [](char c) {
+        return isalnum(static_cast<unsigned char>(c)) || c == '_';
+    };
+    for (size_t at = text.find(name); at != std::string::npos;
+         at = text.find(name, at + 1)) {
+        const size_t end = at + name.size();
+        if ((at == 0 || !is_identifier(text[at - 1])) &&
+            (end == text.size() || !is_identifier(text[end]))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// whether the enclave sources of the project (relative to generated_enclave)
+// or the project headers next to them open files, the enclave reads them
+// through z_stdio.h then. Their tokens are scanned instead of parsed, a
+// fopen in a comment only costs the --wrap of the stdio calls
+bool enclave_uses_stdio(const std::filesystem::path &project_root,
+                        const std::filesystem::path &generated_enclave,
+                        const std::vector<std::string> &sources)
+{
+    std::vector<std::string> files = sources;
+    for (const auto &root : {INSECURE, SECURE}) {
+        if (!std::filesystem::exists(generated_enclave / root)) {
+            continue;
+        }
+        for_each_file_in_path_recursive(
+            generated_enclave / root, [&](const auto &f) {
+                if (is_header_file(f.path())) {
+                    files.push_back(
+                        f.path().lexically_relative(generated_enclave));
+                }
+            });
+    }
+    for (const auto &file : files) {
+        if (!std::filesystem::exists(project_root / file)) {
+            continue;
+        }
+        const auto text = read_file(generated_enclave / file);
+        if (mentions(text, "fopen") || mentions(text, "fopen64")) {
+            DTEE_LOG_DEBUG("%s OPENS FILES\n", file.c_str());
+            return true;
+        }
+    }
+    return false;
+}
+
+// the pure insecure entry funcs of a file (see FunctionInfo::definition)
+// which only call pure entry funcs of the same file, they can run in the
+// enclave
+std::unordered_set<std::string>
+relocatable_funcs(const std::vector<FunctionInfo> &funcs)
+{
+    std::unordered_set<std::string> res;
+    for (const auto &f : funcs) {
+        if (!f.definition.empty()) {
+            res.insert(f.name);
+        }
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const auto &f : funcs) {
+            if (res.count(f.name) == 0) {
+                continue;
+            }
+            for (const auto &callee : f.callees) {
+                if (res.count(callee) == 0) {
+                    DTEE_LOG_DEBUG("%s STAYS AN OCALL: calls %s\n",
+                                   f.name.c_str(), callee.c_str());
+                    res.erase(f.name);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    return res;
+}
+
+// the relocated funcs as the enclave copy of their file defines them,
+// declared first so they can call each other. They name nothing but
+// builtin types and pure libc funcs (see analyze_purity), and keep the
+// linkage they have in their file
+std::string relocated_definitions(const std::vector<FunctionInfo> &funcs)
+{
+    if (funcs.empty()) {
+        return "";
+    }
+    std::string res = "\n// pure, so compiled into the enclave instead of "
+                      "called through ocalls\n"
+                      "#include <math.h>\n"
+                      "#include <stdlib.h>\n";
+    for (const bool c_linkage : {true, false}) {
+        std::string decls, defs;
+        for (const auto &f : funcs) {
+            if (f.c_linkage != c_linkage) {
+                continue;
+            }
+            // the definition ends with the body
+            decls +=
+                f.definition.substr(0, f.definition.size() - f.body.size());
+            while (!decls.empty() && isspace(decls.back())) {
+                decls.pop_back();
+            }
+            decls += ";\n";
+            defs += "\n" + f.definition + "\n";
+        }
+        if (decls.empty()) {
+            continue;
+        }
+        if (c_linkage) {
+            res += "#ifdef __cplusplus\n"
+                   "extern \"C\" {\n"
+                   "#endif\n" +
+                   decls + defs +
+                   "#ifdef __cplusplus\n"
+                   "}\n"
+                   "#endif\n";
+        }
+        else {
+            res += decls + defs;
+        }
+    }
+    return res;
+}
+
+// includes of the headers declaring the user types the funcs of src take,
+// for the stubs generated in its place. Both are copied into the generated
+// trees at the same relative paths, so the includes are relative to src
+std::string type_includes(const std::vector<FunctionInfo> &funcs,
+                          const std::filesystem::path &src,
+                          const std::filesystem::path &project_root)
+{
+    const auto root =
+        std::filesystem::absolute(project_root).lexically_normal();
+    const auto dir =
+        std::filesystem::absolute(src).lexically_normal().parent_path();
+    std::set<std::string> headers;
+    for (const auto &f : funcs) {
+        for (const auto &p : f.parameters) {
+            if (p.type_header.empty()) {
+                continue;
+            }
+            const auto header =
+                std::filesystem::absolute(p.type_header).lexically_normal();
+            const auto in_root = header.lexically_relative(root);
+            if (in_root.empty() || *in_root.begin() == "..") {
+                DTEE_LOG_WARN("%s of %s is declared outside the project in "
+                              "%s, which the stubs can't include\n",
+                              p.type.c_str(), f.name.c_str(),
+                              p.type_header.c_str());
+                continue;
+            }
+            headers.insert(header.lexically_relative(dir).generic_string());
+        }
+    }
+    std::string res;
+    for (const auto &header : headers) {
+        res += "#include \"" + header + "\"\n";
+    }
+    return res;
+}
+
+// report the calls crossing between the worlds: insecure code calling secure
+// entry funcs (ecalls) and secure code calling insecure ones (ocalls). The
+// sites are parsed in process, also with --workers.
+void report_boundary(const std::filesystem::path &insecure_root,
+                     const std::filesystem::path &secure_root,
+                     const std::unordered_set<std::string> &skip_dir,
+                     const std::vector<std::string> &relocated,
+                     const ConvertOptions &opts, ThreadPool &pool)
+{
+    std::vector<std::string> insecure_files, secure_files;
+    for (const auto &[root, files] :
+         {std::make_pair(insecure_root, &insecure_files),
+          std::make_pair(secure_root, &secure_files)}) {
+        for_each_file_in_path_recursive(
+            root,
+            [&, files = files](const auto &f) {
+                if (is_source_file(f.path())) {
+                    files->push_back(f.path().string());
+                }
+            },
+            skip_dir);
+    }
+
+    std::unordered_set<std::string> ecalls, ocalls;
+    for (const auto &f : g_secure_entry_func_list) {
+        ecalls.insert(f.name);
+    }
+    for (const auto &f : g_insecure_entry_func_list) {
+        ocalls.insert(f.name);
+    }
+
+    std::mutex sites_mutex;
+    std::vector<CrossingSite> ecall_sites, ocall_sites;
+    for (const auto &[files, callees, sites] :
+         {std::make_tuple(&insecure_files, &ecalls, &ecall_sites),
+          std::make_tuple(&secure_files, &ocalls, &ocall_sites)}) {
+        for (const auto &file : *files) {
+            pool.enqueue([&, file, callees = callees, sites = sites] {
+                auto found = find_crossing_sites(file, *callees);
+                std::scoped_lock<std::mutex> lock(sites_mutex);
+                sites->insert(sites->end(), found.begin(), found.end());
+            });
+        }
+    }
+    pool.wait_queue_empty();
+    // the pool finishes files in any order
+    for (auto *sites : {&ecall_sites, &ocall_sites}) {
+        std::sort(sites->begin(), sites->end(),
+                  [](const CrossingSite &a, const CrossingSite &b) {
+                      return std::tie(a.caller, a.callee, a.location) <
+                             std::tie(b.caller, b.callee, b.location);
+                  });
+    }
+
+    CrossingCounts counts;
+    if (!opts.crossing_counts.empty() &&
+        !read_crossing_counts(opts.crossing_counts, counts)) {
+        DTEE_LOG_WARN("Unable to read crossing counts %s, ranking by loops\n",
+                      opts.crossing_counts.c_str());
+    }
+    write_boundary_report(opts.boundary_report, ecall_sites, ocall_sites,
+                          counts, ecalls, ocalls, relocated);
+}
+
+// forget what the previous project of a batch collected
+void reset_collected_funcs()
+{
+    g_func_calls_in_insecure_world.clear();
+    g_func_calls_in_secure_world.clear();
+    g_secure_entry_func_list.clear();
+    g_insecure_entry_func_list.clear();
+}
+
+void generate_secgear(const std::filesystem::path project_root,
+                      const std::filesystem::path generated_path,
+                      const ConvertOptions &opts, ThreadPool &pool,
+                      ParseWorkerPool *workers)
 {
-    std::filesystem::path generated_path("generated");
     const auto template_path = std::filesystem::path(TEMPLATE);
     const auto generated_host = generated_path / HOST;
     const auto generated_enclave = generated_path / ENCLAVE;
@@ -41,10 +493,13 @@ void generate_secgear(const std::filesystem::path project_root)
         template_path / "secure_func_template";
     const auto project_template_path = template_path / "project_template";
     const auto project_root_cmake_path = project_root / "CMakeLists.txt";
+    const auto project_assets = project_root / ASSETS;
+    const auto project_embed = project_root / EMBED;
     const auto insecure_root_cmake_path = insecure_root / "CMakeLists.txt";
     const auto secure_root_cmake_path = secure_root / "CMakeLists.txt";
 
     // remove generated first
+    PhaseTimer phase("clean");
     if (std::filesystem::exists(generated_path)) {
         std::filesystem::remove_all(generated_path);
     }
@@ -54,53 +509,86 @@ void generate_secgear(const std::filesystem::path project_root)
     // before call This assumption will not omit 'true call'
     std::unordered_set<std::string> skip_dir = {"secure_lib", "secure_include"};
 
-    ThreadPool pool(POOL_SIZE);
-    DTEE_LOG("Created thread pool with size: %d\n", POOL_SIZE);
+    phase.next("collect");
+    reset_collected_funcs();
     SourceContext ctx;
     ctx.project = project_root.filename();
+    ctx.build_profile = opts.build_profile;
+    ctx.enclave_threads = std::to_string(opts.enclave_threads);
+    // a TCS slot for each of them, the caller and one more host thread, and
+    // no fewer than host callers always had
+    ctx.enclave_tcs =
+        std::to_string(std::max<size_t>(opts.enclave_threads + 2, 10));
 
     DTEE_LOG("BEGIN COLLECT FUNC CALL\n");
-    for_each_file_in_path_recursive_parallel(
-        insecure_root,
-        [&](const auto &insecure_file) {
-            const auto insecure_file_path = insecure_file.path();
-            if (!is_source_file(insecure_file_path)) {
-                return;
-            }
-            // parse insecure file to collect func calls
-            FileContext f_ctx{.file_path = insecure_file_path.string()};
-            parse_file(f_ctx, func_call_collect_visitor);
+    std::vector<std::string> insecure_files, secure_files;
+    if (workers != nullptr) {
+        for (const auto &[root, files] :
+             {std::make_pair(insecure_root, &insecure_files),
+              std::make_pair(secure_root, &secure_files)}) {
+            for_each_file_in_path_recursive(
+                root,
+                [&, files = files](const auto &f) {
+                    if (is_source_file(f.path())) {
+                        files->push_back(f.path().string());
+                    }
+                },
+                skip_dir);
+        }
+        workers->run(ParseRequest::Calls, insecure_files,
+                     [](const std::string &, FileSummary &&s) {
+                         g_func_calls_in_insecure_world.insert(
+                             s.calls.begin(), s.calls.end());
+                     });
+        workers->run(ParseRequest::Calls, secure_files,
+                     [](const std::string &, FileSummary &&s) {
+                         g_func_calls_in_secure_world.insert(s.calls.begin(),
+                                                             s.calls.end());
+                     });
+    }
+    else {
+        for_each_file_in_path_recursive_parallel(
+            insecure_root,
+            [&](const auto &insecure_file) {
+                const auto insecure_file_path = insecure_file.path();
+                if (!is_source_file(insecure_file_path)) {
+                    return;
+                }
+                // parse insecure file to collect func calls
+                FileContext f_ctx{.file_path = insecure_file_path.string()};
+                parse_file(f_ctx, func_call_collect_visitor);
 
-            tls_func_calls_in_insecure_world.insert(
-                tls_func_calls_each_file.begin(),
-                tls_func_calls_each_file.end());
+                tls_func_calls_in_insecure_world.insert(
+                    tls_func_calls_each_file.begin(),
+                    tls_func_calls_each_file.end());
 
-            tls_func_calls_each_file.clear();
-        },
-        skip_dir, pool);
+                tls_func_calls_each_file.clear();
+            },
+            skip_dir, pool);
 
-    for_each_file_in_path_recursive_parallel(
-        secure_root,
-        [&](const auto &secure_file) {
-            const auto secure_file_path = secure_file.path();
+        for_each_file_in_path_recursive_parallel(
+            secure_root,
+            [&](const auto &secure_file) {
+                const auto secure_file_path = secure_file.path();
 
-            if (!is_source_file(secure_file_path)) {
-                return;
-            }
-            // parse secure file to collect func calls
-            FileContext f_ctx{.file_path = secure_file_path.string()};
-            parse_file(f_ctx, func_call_collect_visitor);
-
-            tls_func_calls_in_secure_world.insert(
-                tls_func_calls_each_file.begin(),
-                tls_func_calls_each_file.end());
-            tls_func_calls_each_file.clear();
-        },
-        skip_dir, pool);
+                if (!is_source_file(secure_file_path)) {
+                    return;
+                }
+                // parse secure file to collect func calls
+                FileContext f_ctx{.file_path = secure_file_path.string()};
+                parse_file(f_ctx, func_call_collect_visitor);
+
+                tls_func_calls_in_secure_world.insert(
+                    tls_func_calls_each_file.begin(),
+                    tls_func_calls_each_file.end());
+                tls_func_calls_each_file.clear();
+            },
+            skip_dir, pool);
+    }
 
     pool.wait_queue_empty();
     for (const auto &e : g_func_calls_in_insecure_world) {
-        DTEE_LOG("FUNC CALL IN INSECURE WORLD: %s\n", e.c_str());
+        DTEE_LOG_TRACE("FUNC CALL IN INSECURE WORLD: %s\n", e.c_str());
     }
     // for (const auto &e : g_func_calls_in_secure_world) {
     //     DTEE_LOG("FUNC CALL IN SECURE WORLD: %s\n", e.c_str());
@@ -108,18 +596,12 @@ void generate_secgear(const std::filesystem::path project_root)
     DTEE_LOG("END COLLECT FUNC CALL\n");
 
     std::mutex fs_mutex;
-    const auto process_secure_file = [&](const auto secure_func_file) {
-        const auto secure_func_filepath = secure_func_file.path();
-        if (!is_source_file(secure_func_filepath)) {
-            return;
-        }
-
-        DTEE_LOG("BEGIN PROCESS SECURE FILE: %s\n",
-                 secure_func_file.path().c_str());
-        // collect all secure entry func definition in secure func file
-        FileContext f_ctx{.file_path = secure_func_filepath.string()};
-        parse_file(f_ctx, secure_world_entry_func_def_collect_visitor);
-
+    // insecure entry funcs compiled into the enclave, no longer ocalls
+    std::mutex relocated_mutex;
+    std::vector<std::string> relocated_funcs;
+    // renders the entry funcs of a file, which are in tls_func_list_each_file
+    const auto render_secure_file =
+        [&](const std::filesystem::path &secure_func_filepath) {
         // if the secure file doesn't contain definition of secure entry func,
         // then it's just a normal file, e.g. header file
         if (tls_func_list_each_file.empty()) {
@@ -132,8 +614,9 @@ void generate_secgear(const std::filesystem::path project_root)
             /* std::filesystem::copy_file( */
             /*     secure_func_filepath, new_path, */
             /*     std::filesystem::copy_options::overwrite_existing); */
-            DTEE_LOG("END PROCESS SECURE FILE: %s (no entry func found)\n",
-                     secure_func_file.path().c_str());
+            DTEE_LOG_DEBUG(
+                "END PROCESS SECURE FILE: %s (no entry func found)\n",
+                secure_func_filepath.c_str());
             return;
         }
         else {
@@ -146,36 +629,66 @@ void generate_secgear(const std::filesystem::path project_root)
         ctx.project = project_root.filename();
         ctx.src_path = relative_path(secure_func_filepath, project_root);
         ctx.src_content = read_file_content(secure_func_filepath);
+        ctx.type_includes = type_includes(tls_func_list_each_file,
+                                          secure_func_filepath, project_root);
 
         // process secure func template for funcs in this file
         for_each_file_in_path_recursive(
             secure_func_template_path,
-            [&](const auto &e) { generate_with_template(e.path(), ctx); });
+            [&](const auto &e) {
+                generate_with_template(e.path(), ctx, generated_path);
+            });
 
         tls_secure_entry_func_list.insert(tls_secure_entry_func_list.end(),
                                           tls_func_list_each_file.begin(),
                                           tls_func_list_each_file.end());
         tls_func_list_each_file.clear();
-        DTEE_LOG("END PROCESS SECURE FILE: %s\n",
-                 secure_func_file.path().c_str());
+        DTEE_LOG_DEBUG("END PROCESS SECURE FILE: %s\n",
+                       secure_func_filepath.c_str());
     };
 
-    const auto process_insecure_file = [&, project_root](
-                                           const auto &insecure_func_file) {
-        const auto insecure_func_filepath = insecure_func_file.path();
-        if (!is_source_file(insecure_func_filepath)) {
+    const auto process_secure_file = [&](const auto secure_func_file) {
+        const auto secure_func_filepath = secure_func_file.path();
+        if (!is_source_file(secure_func_filepath)) {
             return;
         }
 
-        DTEE_LOG("BEGIN PROCESS INSECURE FILE: %s\n",
-                 insecure_func_file.path().c_str());
-        FileContext f_ctx{.file_path = insecure_func_filepath.string()};
-        parse_file(f_ctx, insecure_world_entry_func_def_collect_visitor);
+        DTEE_LOG_DEBUG("BEGIN PROCESS SECURE FILE: %s\n",
+                       secure_func_file.path().c_str());
+        // collect all secure entry func definition in secure func file
+        FileContext f_ctx{.file_path = secure_func_filepath.string()};
+        parse_file(f_ctx, secure_world_entry_func_def_collect_visitor);
+        render_secure_file(secure_func_filepath);
+    };
+
+    const auto render_insecure_file =
+        [&, project_root](const std::filesystem::path &insecure_func_filepath) {
+        // pure entry funcs move into the enclave, the rest stay ocalls
+        std::vector<FunctionInfo> relocated;
+        if (!opts.keep_ocalls) {
+            const auto pure = relocatable_funcs(tls_func_list_each_file);
+            const auto moved = std::stable_partition(
+                tls_func_list_each_file.begin(), tls_func_list_each_file.end(),
+                [&](const FunctionInfo &f) { return pure.count(f.name) == 0; });
+            relocated.assign(moved, tls_func_list_each_file.end());
+            tls_func_list_each_file.erase(moved, tls_func_list_each_file.end());
+        }
+        for (const auto &f : relocated) {
+            DTEE_LOG("RELOCATED %s INTO THE ENCLAVE: pure, no ocall needed\n",
+                     f.name.c_str());
+        }
+        if (!relocated.empty()) {
+            std::scoped_lock<std::mutex> lock(relocated_mutex);
+            for (const auto &f : relocated) {
+                relocated_funcs.push_back(f.name);
+            }
+        }
 
         // not contain definition of insecure entry func
-        if (tls_func_list_each_file.empty()) {
-            DTEE_LOG("END PROCESS INSECURE FILE: %s (no entry func found)\n",
-                     insecure_func_file.path().c_str());
+        if (tls_func_list_each_file.empty() && relocated.empty()) {
+            DTEE_LOG_DEBUG(
+                "END PROCESS INSECURE FILE: %s (no entry func found)\n",
+                insecure_func_filepath.c_str());
             return;
         }
 
@@ -183,27 +696,112 @@ void generate_secgear(const std::filesystem::path project_root)
         ctx.project = project_root.filename();
         ctx.src_path = relative_path(insecure_func_filepath, project_root);
         ctx.src_content = read_file_content(insecure_func_filepath);
+        ctx.relocated_defs = relocated_definitions(relocated);
+        ctx.type_includes = type_includes(
+            tls_func_list_each_file, insecure_func_filepath, project_root);
 
         for_each_file_in_path_recursive(
             insecure_func_template_path,
-            [&](const auto &e) { generate_with_template(e.path(), ctx); });
+            [&](const auto &e) {
+                generate_with_template(e.path(), ctx, generated_path);
+            });
 
         tls_insecure_entry_func_list.insert(tls_insecure_entry_func_list.end(),
                                             tls_func_list_each_file.begin(),
                                             tls_func_list_each_file.end());
         tls_func_list_each_file.clear();
-        DTEE_LOG("END PROCESS INSECURE FILE: %s\n",
-                 insecure_func_file.path().c_str());
+        DTEE_LOG_DEBUG("END PROCESS INSECURE FILE: %s\n",
+                       insecure_func_filepath.c_str());
+    };
+
+    const auto process_insecure_file = [&](const auto &insecure_func_file) {
+        const auto insecure_func_filepath = insecure_func_file.path();
+        if (!is_source_file(insecure_func_filepath)) {
+            return;
+        }
+
+        DTEE_LOG_DEBUG("BEGIN PROCESS INSECURE FILE: %s\n",
+                       insecure_func_file.path().c_str());
+        FileContext f_ctx{.file_path = insecure_func_filepath.string()};
+        parse_file(f_ctx, insecure_world_entry_func_def_collect_visitor);
+        render_insecure_file(insecure_func_filepath);
     };
 
-    for_each_file_in_path_recursive_parallel(secure_root, process_secure_file,
-                                             skip_dir, pool);
+    phase.next("entry");
+    if (workers != nullptr) {
+        // workers parse, the pool renders what they found
+        workers->set_calls(g_func_calls_in_insecure_world,
+                           g_func_calls_in_secure_world);
+        const auto render_later = [&](const auto &render) {
+            return [&, render](const std::string &file, FileSummary &&s) {
+                pool.enqueue([render, file, funcs = std::move(s.funcs)] {
+                    tls_func_list_each_file = funcs;
+                    render(file);
+                });
+            };
+        };
+        workers->run(ParseRequest::SecureEntries, secure_files,
+                     render_later(render_secure_file));
+        workers->run(ParseRequest::InsecureEntries, insecure_files,
+                     render_later(render_insecure_file));
+    }
+    else {
+        for_each_file_in_path_recursive_parallel(
+            secure_root, process_secure_file, skip_dir, pool);
 
-    for_each_file_in_path_recursive_parallel(
-        insecure_root, process_insecure_file, skip_dir, pool);
+        for_each_file_in_path_recursive_parallel(
+            insecure_root, process_insecure_file, skip_dir, pool);
+    }
 
     pool.wait_queue_empty();
 
+    // the dispatch tables look entry funcs up by id
+    for (auto *list :
+         {&g_secure_entry_func_list, &g_insecure_entry_func_list}) {
+        std::sort(list->begin(), list->end(),
+                  [](const FunctionInfo &a, const FunctionInfo &b) {
+                      return get_func_id(a.name) < get_func_id(b.name);
+                  });
+        for (size_t i = 1; i < list->size(); ++i) {
+            const auto &a = (*list)[i - 1], &b = (*list)[i];
+            ASSERT(get_func_id(a.name) != get_func_id(b.name),
+                   "entry funcs %s and %s have the same id, rename one",
+                   a.name.c_str(), b.name.c_str());
+        }
+    }
+
+    // streams carry host input into the enclave and partial results out of
+    // it, see z_stream.h
+    size_t stream_params = 0;
+    for (const auto *list :
+         {&g_secure_entry_func_list, &g_insecure_entry_func_list}) {
+        for (const auto &f : *list) {
+            for (const auto &p : f.parameters) {
+                ASSERT(!p.is_stream || list == &g_secure_entry_func_list,
+                       "%s(%s): only secure entry funcs take a dtee_stream",
+                       f.name.c_str(), p.name.c_str());
+                stream_params += p.is_stream;
+            }
+        }
+    }
+    if (stream_params != 0) {
+        DTEE_LOG("%zu STREAM PARAMS CROSS AS THE CALLS RUN\n", stream_params);
+    }
+
+    std::sort(relocated_funcs.begin(), relocated_funcs.end());
+    if (!relocated_funcs.empty()) {
+        DTEE_LOG("RELOCATED %zu INSECURE ENTRY FUNCS INTO THE ENCLAVE, %zu "
+                 "OCALLS LEFT\n",
+                 relocated_funcs.size(), g_insecure_entry_func_list.size());
+    }
+
+    if (!opts.boundary_report.empty()) {
+        phase.next("boundary");
+        report_boundary(insecure_root, secure_root, skip_dir, relocated_funcs,
+                        opts, pool);
+    }
+
+    phase.next("project");
     DTEE_LOG("process project level template now\n");
     if (std::filesystem::exists(insecure_root_cmake_path)) {
         ctx.root_cmake = read_file_content(insecure_root_cmake_path);
@@ -213,74 +811,437 @@ void generate_secgear(const std::filesystem::path project_root)
         ctx.host_secure_cmake = read_file_content(secure_root_cmake_path);
     }
 
+    // the enclave is built with the hash of the assets, not with them
+    if (std::filesystem::is_directory(project_assets)) {
+        const auto bundle =
+            pack_assets(project_assets, generated_path / ASSET_BUNDLE);
+        ctx.assets_size = std::to_string(bundle.size);
+        std::stringstream hash;
+        for (const auto b : bundle.hash) {
+            hash << (hash.tellp() == 0 ? "" : ", ") << (unsigned)b;
+        }
+        ctx.assets_hash = hash.str();
+        DTEE_LOG("PACKED %zu ASSETS INTO %s (%llu BYTES)\n", bundle.count,
+                 ASSET_BUNDLE, (unsigned long long)bundle.size);
+    }
+    // and with embed/ linked in as it is, not as C arrays to compile
+    if (std::filesystem::is_directory(project_embed)) {
+        const auto embedded =
+            embed_files(project_embed, generated_enclave / EMBED);
+        ctx.embed_asm = embedded.assembly;
+        ctx.embed_decls = embedded.declarations;
+        DTEE_LOG("EMBEDDED %zu FILES INTO THE ENCLAVE (%ju BYTES)\n",
+                 embedded.count, embedded.bytes);
+    }
+
+    for (const auto &func : g_secure_entry_func_list) {
+        for (const auto &param : func.parameters) {
+            if (param.is_shared) {
+                ctx.shared_region = "1";
+            }
+        }
+    }
+
     for_each_file_in_path_recursive(project_template_path, [&](const auto &f) {
-        generate_with_template(f.path(), ctx);
+        if (LATE_PROJECT_TEMPLATES.count(f.path().filename()) == 0) {
+            generate_with_template(f.path(), ctx, generated_path);
+        }
     });
 
+    phase.next("prune");
+    // only headers the enclave sources (secure sources and what the templates
+    // generated) can reach are materialized in the enclave tree
+    std::vector<std::filesystem::path> enclave_sources;
+    const auto collect_source = [&](const auto &f) {
+        if (is_source_file(f.path())) {
+            enclave_sources.push_back(f.path());
+        }
+    };
+    for_each_file_in_path_recursive(secure_root, collect_source, skip_dir);
+    for_each_file_in_path_recursive(generated_enclave, collect_source);
+    IncludeGraph enclave_graph({secure_root, insecure_root});
+    const auto closure = enclave_graph.closure(enclave_sources);
+    size_t header_count = 0, pruned_count = 0;
+    const auto keep_in_enclave = [&](const std::filesystem::path &p) {
+        if (!is_header_file(p)) {
+            return true;
+        }
+        ++header_count;
+        if (!closure.complete ||
+            closure.files.count(p.lexically_normal().string()) != 0) {
+            return true;
+        }
+        ++pruned_count;
+        return false;
+    };
+    const auto copy_to_enclave = [&](const std::filesystem::path &from,
+                                     const std::filesystem::path &to) {
+        std::filesystem::create_directories(to.parent_path());
+        std::filesystem::copy_file(from, to, SKIP_COPY_OPTION);
+    };
+
+    phase.next("copy");
     // copy remaining files in secure world to enclave
     for_each_file_in_path_recursive(
         secure_root,
         [&](const auto &f) {
-            const auto new_path =
-                generated_enclave / f.path().lexically_relative(project_root);
-            std::filesystem::create_directories(new_path.parent_path());
-            std::filesystem::copy_file(f.path(), new_path, SKIP_COPY_OPTION);
+            if (!keep_in_enclave(f.path())) {
+                return;
+            }
+            copy_to_enclave(f.path(),
+                            generated_enclave /
+                                f.path().lexically_relative(project_root));
         },
         skip_dir);
 
-    // copy headers in insecure world to enclave, cause insecure world can
+    // copy headers in insecure world to enclave, cause secure world can
     // include them
     for_each_file_in_path_recursive(insecure_root, [&](const auto &f) {
-        if (!(f.path().extension() == ".h")) {
+        if (closure.complete ? !is_header_file(f.path())
+                             : f.path().extension() != ".h") {
             return;
         }
-        const auto new_path =
-            generated_enclave / f.path().lexically_relative(project_root);
-        std::filesystem::create_directories(new_path.parent_path());
-        std::filesystem::copy_file(f.path(), new_path, SKIP_COPY_OPTION);
+        if (!keep_in_enclave(f.path())) {
+            return;
+        }
+        copy_to_enclave(f.path(),
+                        generated_enclave /
+                            f.path().lexically_relative(project_root));
     });
 
-    // copy enclave libs
-    if (std::filesystem::exists(project_secure_lib)) {
-        std::filesystem::create_directories(generated_enclave_lib);
-        for (const auto &f :
-             std::filesystem::directory_iterator(project_secure_lib)) {
-            const auto relative_path =
-                f.path().lexically_relative(project_secure_lib);
-
-            std::filesystem::copy(f.path(),
-                                  generated_enclave_lib / relative_path,
-                                  DIRECTORY_COPY_OPTION);
+    // copy enclave libs and includes
+    for (const auto &[from, to] :
+         {std::make_pair(project_secure_lib, generated_enclave_lib),
+          std::make_pair(project_secure_include, generated_enclave_include)}) {
+        if (!std::filesystem::exists(from)) {
+            continue;
         }
-    }
-
-    // copy enclave includes
-    if (std::filesystem::exists(project_secure_include)) {
-        std::filesystem::create_directories(generated_enclave_include);
-        for (const auto &f :
-             std::filesystem::directory_iterator(project_secure_include)) {
-            const auto relative_path =
-                f.path().lexically_relative(project_secure_include);
-
+        std::filesystem::create_directories(to);
+        for_each_file_in_path_recursive(from, [&](const auto &f) {
+            if (!keep_in_enclave(f.path())) {
+                return;
+            }
+            std::filesystem::create_directories(
+                (to / f.path().lexically_relative(from)).parent_path());
             std::filesystem::copy(f.path(),
-                                  generated_enclave_include / relative_path,
+                                  to / f.path().lexically_relative(from),
                                   DIRECTORY_COPY_OPTION);
-        }
+        });
+    }
+    if (closure.complete) {
+        DTEE_LOG("PRUNED %zu OF %zu HEADERS FROM ENCLAVE\n", pruned_count,
+                 header_count);
+    }
+    else {
+        DTEE_LOG_WARN("include closure incomplete, copied all headers\n");
     }
 
-    // copy remaining files in project root to host
+
+    // copy remaining files in project root to host, the assets are in the
+    // bundle and the embedded files in the enclave
     for_each_file_in_path_recursive(project_root, [&](const auto &f) {
-        const auto new_path =
-            generated_host / f.path().lexically_relative(project_root);
+        const auto rel = f.path().lexically_relative(project_root);
+        if (*rel.begin() == ASSETS || *rel.begin() == EMBED) {
+            return;
+        }
+        const auto new_path = generated_host / rel;
         std::filesystem::create_directories(new_path.parent_path());
         std::filesystem::copy_file(f.path(), new_path, SKIP_COPY_OPTION);
     });
 
     replace_case_insensitive(generated_host / SECURE / "CMakeLists.txt",
                              "add_library", "tee_add_library");
+
+    phase.next("reach");
+    // list the enclave sources explicitly, and only put the directories
+    // includes were actually resolved against on the include path. Headers
+    // in enclave_include/enclave_lib are found through the INCLUDE_DIRS the
+    // project declares, as before.
+    std::vector<std::string> enclave_source_list;
+    for (const auto &root :
+         {generated_enclave / INSECURE, generated_enclave / SECURE}) {
+        if (!std::filesystem::exists(root)) {
+            continue;
+        }
+        for_each_file_in_path_recursive(root, [&](const auto &f) {
+            if (is_source_file(f.path())) {
+                enclave_source_list.push_back(
+                    f.path().lexically_relative(generated_enclave).string());
+            }
+        });
+    }
+    std::sort(enclave_source_list.begin(), enclave_source_list.end());
+    if (opts.prune_unreachable) {
+        prune_unreachable_sources(
+            project_root, generated_enclave, enclave_source_list,
+            collect_enclave_symbols(generated_enclave, enclave_source_list,
+                                    pool, workers));
+    }
+    if (enclave_uses_stdio(project_root, generated_enclave,
+                           enclave_source_list)) {
+        ctx.enclave_stdio = "ON";
+        DTEE_LOG("ENCLAVE FILE READS GO THROUGH z_stdio.h\n");
+    }
+
+    phase.next("build");
+    for (const auto &src : enclave_source_list) {
+        ctx.enclave_sources += "\n  ${CMAKE_CURRENT_SOURCE_DIR}/" + src;
+    }
+
+    if (closure.complete) {
+        std::set<std::string> include_dirs;
+        for (const auto &dir : closure.include_dirs) {
+            const auto rel = std::filesystem::path(dir).lexically_relative(
+                project_root.lexically_normal());
+            auto it = rel.begin();
+            if (it == rel.end() || (*it != SECURE && *it != INSECURE)) {
+                continue;
+            }
+            if (*it == SECURE && std::next(it) != rel.end() &&
+                skip_dir.count(std::next(it)->string()) != 0) {
+                continue;
+            }
+            include_dirs.insert(rel.generic_string());
+        }
+        // same order the recursive walk had, insecure before secure
+        for (const auto &world : {INSECURE, SECURE}) {
+            for (const auto &dir : include_dirs) {
+                if (*std::filesystem::path(dir).begin() == world) {
+                    ctx.enclave_include_dirs +=
+                        "\n  ${CMAKE_CURRENT_SOURCE_DIR}/" + dir;
+                }
+            }
+        }
+        ctx.minimal_include_dirs = "ON";
+        DTEE_LOG("ENCLAVE NEEDS %zu INCLUDE DIRS\n", include_dirs.size());
+    }
+
+    if (opts.unity_groups != 0) {
+        // only c++ sources are merged, a .c file would change language
+        std::vector<std::string> cxx_sources, other_sources;
+        for (const auto &src : enclave_source_list) {
+            (std::filesystem::path(src).extension() == ".c" ? other_sources
+                                                            : cxx_sources)
+                .push_back(src);
+        }
+        const auto groups = balance_unity_groups(
+            generated_enclave, cxx_sources,
+            std::min(opts.unity_groups, cxx_sources.size()));
+        if (groups.size() < cxx_sources.size()) {
+            std::filesystem::create_directories(generated_enclave / UNITY_DIR);
+            for (size_t i = 0; i < groups.size(); ++i) {
+                const auto name = std::string(UNITY_DIR "/unity_") +
+                                  std::to_string(i) + ".cpp";
+                std::ofstream out(generated_enclave / name);
+                out << "// unity build generated by dteegen\n";
+                for (const auto &src : groups[i]) {
+                    out << "#include \"../" << src << "\"\n";
+                }
+                ctx.enclave_unity_sources +=
+                    "\n  ${CMAKE_CURRENT_SOURCE_DIR}/" + name;
+            }
+            for (const auto &src : other_sources) {
+                ctx.enclave_unity_sources +=
+                    "\n  ${CMAKE_CURRENT_SOURCE_DIR}/" + src;
+            }
+            DTEE_LOG("MERGED %zu ENCLAVE SOURCES INTO %zu UNITY SOURCES\n",
+                     cxx_sources.size(), groups.size());
+        }
+
+        size_t host_sources = 0;
+        for_each_file_in_path_recursive(
+            generated_host / SECURE,
+            [&](const auto &f) { host_sources += is_source_file(f.path()); },
+            skip_dir);
+        if (host_sources > opts.unity_groups) {
+            ctx.host_unity_batch_size = std::to_string(
+                (host_sources + opts.unity_groups - 1) / opts.unity_groups);
+        }
+    }
+
+    if (opts.pch && closure.complete) {
+        // the graph maps both project and generated files, put them where
+        // the enclave tree has them
+        const auto enclave_path =
+            [&](const std::filesystem::path &p) -> std::string {
+            for (const auto &[from, to] : {
+                     std::make_pair(generated_enclave, std::string()),
+                     std::make_pair(project_secure_include,
+                                    std::string(ENCLAVE_INCLUDE "/")),
+                     std::make_pair(project_secure_lib,
+                                    std::string(ENCLAVE_LIB "/")),
+                     std::make_pair(project_root, std::string()),
+                 }) {
+                const auto rel = p.lexically_relative(from.lexically_normal());
+                if (!rel.empty() && *rel.begin() != "..") {
+                    return to + rel.generic_string();
+                }
+            }
+            return "";
+        };
+        std::vector<std::filesystem::path> sources;
+        for (const auto &src : enclave_source_list) {
+            sources.push_back(generated_enclave / src);
+        }
+        for (const auto &header :
+             choose_precompiled_headers(enclave_graph, sources)) {
+            const auto path = enclave_path(header);
+            if (!path.empty()) {
+                ctx.enclave_pch_headers +=
+                    "\n  ${CMAKE_CURRENT_SOURCE_DIR}/" + path;
+            }
+        }
+
+        std::vector<std::filesystem::path> host_sources;
+        for_each_file_in_path_recursive(
+            generated_host / SECURE,
+            [&](const auto &f) {
+                if (is_source_file(f.path())) {
+                    host_sources.push_back(f.path());
+                }
+            },
+            skip_dir);
+        IncludeGraph host_graph({generated_host / SECURE});
+        for (const auto &header :
+             choose_precompiled_headers(host_graph, host_sources)) {
+            ctx.host_pch_headers +=
+                "\n  ${CMAKE_CURRENT_SOURCE_DIR}/" +
+                std::filesystem::path(header)
+                    .lexically_relative(generated_host / SECURE)
+                    .generic_string();
+        }
+    }
+
+    for (const auto &name : LATE_PROJECT_TEMPLATES) {
+        generate_with_template(project_template_path / name, ctx,
+                               generated_path);
+    }
+}
+
+struct ConvertTarget
+{
+    std::filesystem::path project;
+    // the generated tree
+    std::filesystem::path output;
+    // overrides --enclave-threads if not negative
+    int enclave_threads = -1;
+};
+
+// several projects share the thread pool, the parsed translation units and
+// the templates, and are converted one after the other. Returns false if
+// some file could not be parsed
+bool convert(const std::vector<ConvertTarget> &targets,
+             const ConvertOptions &opts)
+{
+    ThreadPool pool(opts.jobs);
+    DTEE_LOG("Created thread pool with size: %zu\n", opts.jobs);
+    std::unique_ptr<ParseWorkerPool> workers;
+    if (opts.workers != 0) {
+        workers = std::make_unique<ParseWorkerPool>(
+            opts.workers, opts.worker_mem_mb, opts.worker_retries,
+            opts.worker_timeout_s);
+    }
+    ASSERT(targets.size() == 1 || opts.boundary_report.empty(),
+           "--boundary-report can only be used with a single project");
+    for (const auto &target : targets) {
+        DTEE_LOG("CONVERT %s TO %s\n", target.project.c_str(),
+                 target.output.c_str());
+        ConvertOptions target_opts = opts;
+        if (target.enclave_threads >= 0) {
+            target_opts.enclave_threads = target.enclave_threads;
+        }
+        generate_secgear(target.project, target.output, target_opts, pool,
+                         workers.get());
+    }
+
+    if (workers && !workers->failed().empty()) {
+        // no stamp, so a build system retries the conversion
+        for (const auto &f : workers->failed()) {
+            DTEE_LOG_ERROR("FAILED TO PARSE %s\n", f.c_str());
+        }
+        return false;
+    }
+    if (opts.depfile.empty() && opts.stamp.empty()) {
+        return true;
+    }
+    PhaseTimer phase("deps");
+    ASSERT(targets.size() == 1 || !opts.stamp.empty(),
+           "--stamp is required to convert several projects with --depfile");
+    const auto stamp = opts.stamp.empty()
+                           ? targets.front().output / STAMP_FILE
+                           : std::filesystem::path(opts.stamp);
+    // one stamp and one depfile for the whole batch, it's one command
+    std::vector<std::filesystem::path> outputs;
+    for (const auto &target : targets) {
+        for_each_file_in_path_recursive(target.output, [&](const auto &f) {
+            if (f.path().lexically_normal() != stamp.lexically_normal()) {
+                outputs.push_back(f.path());
+            }
+        });
+    }
+    write_stamp(stamp, outputs);
+
+    if (!opts.depfile.empty()) {
+        // the whole project is copied to the host tree, so every file of it
+        // is an input. Directories too, so adding or removing a file reruns
+        // the conversion.
+        std::vector<std::filesystem::path> inputs;
+        std::vector<std::filesystem::path> roots = {
+            INSECURE_FUNC_TEMPLATE_PATH, SECURE_FUNC_TEMPLATE_PATH,
+            PROJECT_TEMPLATE_PATH};
+        for (const auto &target : targets) {
+            roots.push_back(target.project);
+        }
+        for (const auto &root : roots) {
+            inputs.push_back(root);
+            for_each_in_dir_recurisive(
+                root, [&](const auto &f) { inputs.push_back(f.path()); });
+        }
+        for (const auto &f :
+             workers ? workers->parsed_files() : parsed_files()) {
+            inputs.push_back(f);
+        }
+        write_depfile(opts.depfile, stamp, inputs);
+        DTEE_LOG("WROTE DEPFILE %s: %zu INPUTS, %zu OUTPUTS\n",
+                 opts.depfile.c_str(), inputs.size(), outputs.size());
+    }
+    return true;
+}
+
+// "<project> [output] [--enclave-threads n]" per line, # comments
+std::vector<ConvertTarget> read_manifest(const std::string &manifest)
+{
+    std::ifstream ifs(manifest);
+    ASSERT(ifs, "Unable to open manifest: %s", manifest.c_str());
+    std::vector<ConvertTarget> res;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream ss(line);
+        ConvertTarget target;
+        std::string project, word;
+        if (!(ss >> project)) {
+            continue;
+        }
+        target.project = project;
+        while (ss >> word) {
+            if (word == "--enclave-threads") {
+                const bool counted = !!(ss >> target.enclave_threads);
+                ASSERT(counted, "%s: --enclave-threads needs a count for %s",
+                       manifest.c_str(), project.c_str());
+                target.enclave_threads = std::max(0, target.enclave_threads);
+            }
+            else {
+                ASSERT(target.output.empty(), "%s: unexpected %s for %s",
+                       manifest.c_str(), word.c_str(), project.c_str());
+                target.output = word;
+            }
+        }
+        res.push_back(target);
+    }
+    return res;
 }
 
-void convert(std::string project_path) { generate_secgear(project_path); }
 void create(const char *project_path)
 {
     const auto project_root = std::filesystem::path(project_path);
@@ -308,7 +1269,7 @@ void create(const char *project_path)
     for_each_file_in_path_recursive(TEE_CAPABILITY_PATH, [&](const auto &f) {
         const auto new_path =
             project_root / ".dev" / f.path().lexically_relative(TEMPLATE);
-        std::cout << new_path << std::endl;
+        DTEE_LOG_DEBUG("COPY %s\n", new_path.c_str());
         std::filesystem::create_directories(new_path.parent_path());
         std::filesystem::copy_file(f.path(), new_path, SKIP_COPY_OPTION);
     });
@@ -317,25 +1278,193 @@ void create(const char *project_path)
 // 主函数
 int main(int argc, char **argv)
 {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " [create]/[convert]"
-                  << " [project_path]\n";
-        return 1;
+    // split options from positional args
+    std::vector<const char *> args;
+    ConvertOptions opts;
+    bool help = false, parse_worker = false;
+    std::string output, manifest;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            help = true;
+        }
+        else if ((!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) &&
+            i + 1 < argc) {
+            opts.jobs = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--unity") && i + 1 < argc) {
+            opts.unity_groups = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--pch")) {
+            opts.pch = true;
+        }
+        else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+            opts.workers = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--worker-mem") && i + 1 < argc) {
+            opts.worker_mem_mb = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--worker-retries") && i + 1 < argc) {
+            opts.worker_retries = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--worker-timeout") && i + 1 < argc) {
+            opts.worker_timeout_s = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            opts.build_profile = build_profile_name(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--prune-unreachable")) {
+            opts.prune_unreachable = true;
+        }
+        // the default now, still accepted
+        else if (!strcmp(argv[i], "--keep-unreachable")) {
+            opts.prune_unreachable = false;
+        }
+        else if (!strcmp(argv[i], "--keep-ocalls")) {
+            opts.keep_ocalls = true;
+        }
+        else if (!strcmp(argv[i], "--enclave-threads") && i + 1 < argc) {
+            opts.enclave_threads = std::max(0, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--boundary-report") && i + 1 < argc) {
+            opts.boundary_report = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--crossing-counts") && i + 1 < argc) {
+            opts.crossing_counts = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--parse-worker")) {
+            parse_worker = true;
+        }
+        else if (!strcmp(argv[i], "--depfile") && i + 1 < argc) {
+            opts.depfile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--stamp") && i + 1 < argc) {
+            opts.stamp = argv[++i];
+        }
+        else if ((!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) &&
+                 i + 1 < argc) {
+            output = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--manifest") && i + 1 < argc) {
+            manifest = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quiet")) {
+            dtee_log::set_level(dtee_log::Level::Warn);
+        }
+        else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+            dtee_log::set_level(dtee_log::Level::Debug);
+        }
+        else if (!strcmp(argv[i], "-vv")) {
+            dtee_log::set_level(dtee_log::Level::Trace);
+        }
+        else {
+            args.push_back(argv[i]);
+        }
+    }
+
+    if (parse_worker) {
+        return parse_worker_main();
+    }
+
+    const bool has_project =
+        args.size() >= 2 || (args.size() == 1 && !manifest.empty());
+    if (help || !has_project) {
+        (help ? std::cout : std::cerr)
+            << "Usage: " << argv[0] << " [-q|-v|-vv] [-j jobs]"
+            << " [--unity groups] [--pch]"
+            << " [--workers n [--worker-mem MiB] [--worker-retries n]"
+            << " [--worker-timeout s]]"
+            << " [--profile release|debug|pgo-generate|pgo-use]"
+            << " [--prune-unreachable] [--keep-ocalls] [--enclave-threads n]"
+            << " [--depfile file] [--stamp file]"
+            << " [--boundary-report file [--crossing-counts file]]"
+            << " [create]/[convert]"
+            << " [project_path]\n"
+            << "       " << argv[0] << " [options] convert [-o output]"
+            << " project_path\n"
+            << "       " << argv[0] << " [options] convert project_path..."
+            << " [--manifest file]\n"
+            << "A single project is generated into ./generated (or -o), "
+               "several into ./<project>.generated. The output is removed "
+               "first, so it can't hold the project or ./.\n"
+               "Manifest lines are \"project_path [output] "
+               "[--enclave-threads n]\".\n"
+               "--workers parses in n processes, a file crashing its worker "
+               "or taking longer than --worker-timeout (600s, 0 for none) "
+               "is retried and then reported.\n"
+               "--prune-unreachable doesn't build the enclave sources no "
+               "entry func reaches by name, funcs only reached through "
+               "pointers, virtual calls or dlsym go with them.\n"
+               "Pure insecure funcs the enclave calls are compiled into it "
+               "instead of becoming ocalls, unless --keep-ocalls or annotated "
+               "with __attribute__((annotate(\"" KEEP_OCALL_ANNOTATION
+               "\"))).\n"
+               "--enclave-threads lets up to n host threads run enclave "
+               "threads besides the caller, by default (0) the enclave is "
+               "single threaded.\n"
+               "--profile picks the default enclave build profile, "
+               "ENCLAVE_BUILD_PROFILE overrides it at configure time.\n"
+               "--boundary-report lists the calls crossing between the "
+               "worlds and which to fuse, --crossing-counts ranks them by "
+               "what a host run with DTEE_CROSSING_COUNTS=file counted.\n";
+        return help ? 0 : 1;
     }
 
     // measure time
     auto start = std::chrono::high_resolution_clock::now();
-    if (!strcmp(argv[1], "create")) {
-        create(argv[2]);
+    bool ok = true;
+    if (!strcmp(args[0], "create")) {
+        create(args[1]);
     }
-    else if (!strcmp(argv[1], "convert")) {
-        convert(argv[2]);
+    else if (!strcmp(args[0], "convert")) {
+        std::vector<ConvertTarget> targets;
+        for (size_t i = 1; i < args.size(); ++i) {
+            targets.push_back({args[i], ""});
+        }
+        if (!manifest.empty()) {
+            const auto listed = read_manifest(manifest);
+            targets.insert(targets.end(), listed.begin(), listed.end());
+        }
+        ASSERT(output.empty() || targets.size() == 1,
+               "-o can only be used with a single project");
+
+        std::unordered_set<std::string> outputs;
+        for (auto &target : targets) {
+            // "a/b/" would make the project name empty
+            target.project = target.project.lexically_normal();
+            if (!target.project.has_filename()) {
+                target.project = target.project.parent_path();
+            }
+            if (target.output.empty()) {
+                if (!output.empty()) {
+                    target.output = output;
+                }
+                else if (targets.size() == 1) {
+                    target.output = "generated";
+                }
+                else {
+                    target.output =
+                        target.project.filename().string() + ".generated";
+                }
+            }
+            ASSERT(outputs.insert(target.output.lexically_normal()).second,
+                   "Two projects generated into %s", target.output.c_str());
+            // the output is removed before it's generated
+            for (const auto &kept : {target.project,
+                                     std::filesystem::current_path(),
+                                     std::filesystem::path(TEMPLATE)}) {
+                ASSERT(!is_same_or_ancestor(target.output, kept),
+                       "Refusing to generate into %s, it holds %s",
+                       target.output.c_str(), kept.c_str());
+            }
+        }
+        ok = convert(targets, opts);
     }
 
     auto end = std::chrono::high_resolution_clock::now();
     auto time =
         std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
             .count();
+    dtee_log::flush();
     std::cout << "Time: " << time << "ms" << std::endl;
-    return 0;
+    return ok ? 0 : 1;
 }
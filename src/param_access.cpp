@@ -0,0 +1,446 @@
+#include "param_access.h"
+
+#include "clang-c/CXString.h"
+#include "clang-c/Index.h"
+#include "libclang.h"
+#include "pch.h"
+
+namespace {
+
+constexpr BufferAccess NO_ACCESS{false, false};
+constexpr BufferAccess READ{true, false};
+constexpr BufferAccess WRITE{false, true};
+constexpr BufferAccess READ_WRITE{true, true};
+constexpr size_t NO_PARENT = static_cast<size_t>(-1);
+
+// std callees taking mutable pointers they only read, mostly iterator
+// templates whose parameter types say nothing. name -> read-only argument
+// indices. Only consulted for callees in namespace std, a project's own copy
+// or insert may well write
+const std::unordered_map<std::string, std::unordered_set<int>> READ_ONLY_ARGS =
+    {
+        {"basic_string", {0, 1}}, {"assign", {0, 1}}, {"append", {0, 1}},
+        {"vector", {0, 1}},       {"insert", {1, 2}}, {"copy", {0, 1}},
+        {"copy_n", {0}},          {"equal", {0, 1, 2}}, {"find", {0, 1}},
+        {"count", {0, 1}},
+};
+
+// variadic libc callees which only read their variadic arguments
+const std::unordered_set<std::string> READ_ONLY_VARARGS = {
+    "printf", "fprintf", "dprintf", "sprintf", "snprintf", "syslog"};
+
+struct Walk
+{
+    CXTranslationUnit tu;
+    // params and local pointers initialized from them -> param index
+    std::vector<std::pair<CXCursor, size_t>> tracked;
+    std::vector<BufferAccess> res;
+    // the function body down to the cursor being visited
+    std::vector<CXCursor> stack;
+    // param whose use is being classified
+    size_t param;
+};
+
+std::string spelling(CXString str)
+{
+    std::string res = clang_getCString(str);
+    clang_disposeString(str);
+    return res;
+}
+
+std::vector<CXCursor> children(CXCursor cursor)
+{
+    std::vector<CXCursor> res;
+    clang_visitChildren(
+        cursor,
+        [](CXCursor c, CXCursor, CXClientData data) {
+            static_cast<std::vector<CXCursor> *>(data)->push_back(c);
+            return CXChildVisit_Continue;
+        },
+        &res);
+    return res;
+}
+
+bool is_first_child(CXCursor parent, CXCursor child)
+{
+    const auto c = children(parent);
+    return !c.empty() && clang_equalCursors(c.front(), child);
+}
+
+unsigned offset_of(CXSourceLocation loc)
+{
+    unsigned offset = 0;
+    clang_getSpellingLocation(loc, nullptr, nullptr, nullptr, &offset);
+    return offset;
+}
+
+// the operator of a unary or binary expression, libclang doesn't expose it
+// before clang 17 so it's read from the tokens
+std::string operator_spelling(CXTranslationUnit tu, CXCursor op)
+{
+    const auto operands = children(op);
+    if (operands.empty()) {
+        return "";
+    }
+    const auto operand = clang_getCursorExtent(operands.front());
+
+    CXToken *tokens = nullptr;
+    unsigned n = 0;
+    clang_tokenize(tu, clang_getCursorExtent(op), &tokens, &n);
+    std::string res;
+    if (n != 0) {
+        const auto token_start = [&](unsigned i) {
+            return offset_of(
+                clang_getRangeStart(clang_getTokenExtent(tu, tokens[i])));
+        };
+        if (clang_getCursorKind(op) == CXCursor_UnaryOperator) {
+            // prefix if it starts before its operand, else postfix
+            const bool prefix =
+                token_start(0) < offset_of(clang_getRangeStart(operand));
+            res = spelling(
+                clang_getTokenSpelling(tu, tokens[prefix ? 0 : n - 1]));
+        }
+        else {
+            const unsigned lhs_end = offset_of(clang_getRangeEnd(operand));
+            for (unsigned i = 0; i < n; ++i) {
+                if (token_start(i) >= lhs_end) {
+                    res = spelling(clang_getTokenSpelling(tu, tokens[i]));
+                    break;
+                }
+            }
+        }
+    }
+    clang_disposeTokens(tu, tokens, n);
+    return res;
+}
+
+bool is_pointer(CXType type)
+{
+    return clang_getCanonicalType(type).kind == CXType_Pointer;
+}
+
+bool is_mutable_reference(CXType type)
+{
+    type = clang_getCanonicalType(type);
+    return (type.kind == CXType_LValueReference ||
+            type.kind == CXType_RValueReference) &&
+           !clang_isConstQualifiedType(clang_getPointeeType(type));
+}
+
+// declared in namespace std, or one nested in it like std::__cxx11
+bool in_std(CXCursor cursor)
+{
+    std::string outermost;
+    for (CXCursor c = clang_getCursorSemanticParent(cursor);
+         !clang_Cursor_isNull(c) &&
+         clang_getCursorKind(c) != CXCursor_TranslationUnit;
+         c = clang_getCursorSemanticParent(c)) {
+        if (clang_getCursorKind(c) == CXCursor_Namespace) {
+            outermost = spelling(clang_getCursorSpelling(c));
+        }
+    }
+    return outermost == "std";
+}
+
+bool pointee_is_const(CXType type)
+{
+    return clang_isConstQualifiedType(
+        clang_getPointeeType(clang_getCanonicalType(type)));
+}
+
+// closest ancestor of stack[i] that isn't an implicit conversion or
+// parentheses
+size_t parent_index(const std::vector<CXCursor> &stack, size_t i)
+{
+    while (i > 0) {
+        const auto kind = clang_getCursorKind(stack[i - 1]);
+        if (kind != CXCursor_UnexposedExpr && kind != CXCursor_ParenExpr) {
+            return i - 1;
+        }
+        --i;
+    }
+    return NO_PARENT;
+}
+
+BufferAccess pointer_access(Walk &w, size_t i);
+
+// stack[call] is a call, stack[call + 1] one of its arguments
+BufferAccess call_arg_access(Walk &w, size_t call)
+{
+    const CXCursor expr = w.stack[call], arg = w.stack[call + 1];
+    int index = -1;
+    for (int k = 0; k < clang_Cursor_getNumArguments(expr); ++k) {
+        if (clang_equalCursors(clang_Cursor_getArgument(expr, k), arg)) {
+            index = k;
+            break;
+        }
+    }
+    const CXCursor callee = clang_getCursorReferenced(expr);
+    // e.g. the object of a member call, or a call through a pointer
+    if (index < 0 || clang_Cursor_isNull(callee)) {
+        return READ_WRITE;
+    }
+
+    const auto name = spelling(clang_getCursorSpelling(callee));
+    // a template the call doesn't resolve to a specialization of has none
+    const int params = clang_Cursor_getNumArguments(callee);
+    if (params >= 0 && index >= params) {
+        return clang_Cursor_isVariadic(callee) &&
+                       READ_ONLY_VARARGS.count(name) != 0 &&
+                       clang_Location_isInSystemHeader(
+                           clang_getCursorLocation(callee))
+                   ? READ
+                   : READ_WRITE;
+    }
+    // what the declaration says comes first, the table only covers mutable
+    // parameters of std templates
+    if (index < params) {
+        const auto type = clang_getCanonicalType(
+            clang_getCursorType(clang_Cursor_getArgument(callee, index)));
+        const bool by_pointer = type.kind == CXType_Pointer ||
+                                type.kind == CXType_LValueReference ||
+                                type.kind == CXType_RValueReference;
+        if (by_pointer && pointee_is_const(type)) {
+            return READ;
+        }
+        // taken by value, e.g. converted to bool
+        if (!by_pointer && type.kind >= CXType_FirstBuiltin &&
+            type.kind <= CXType_LastBuiltin) {
+            return NO_ACCESS;
+        }
+    }
+    const auto known = READ_ONLY_ARGS.find(name);
+    if (known != READ_ONLY_ARGS.end() && known->second.count(index) != 0 &&
+        in_std(callee)) {
+        return READ;
+    }
+    return READ_WRITE;
+}
+
+// stack[i] is an element of the buffer (p[n], *p)
+BufferAccess element_access(Walk &w, size_t i)
+{
+    const size_t p = parent_index(w.stack, i);
+    if (p == NO_PARENT) {
+        return NO_ACCESS;
+    }
+    const CXCursor parent = w.stack[p], child = w.stack[p + 1];
+    switch (clang_getCursorKind(parent)) {
+    case CXCursor_BinaryOperator: {
+        const auto op = operator_spelling(w.tu, parent);
+        // (0, p[n]) is still the element
+        if (op == ",") {
+            return is_first_child(parent, child) ? READ : element_access(w, p);
+        }
+        return is_first_child(parent, child) && op == "=" ? WRITE : READ;
+    }
+    case CXCursor_ConditionalOperator:
+        // (c ? p[n] : x) = y assigns the element
+        return is_first_child(parent, child) ? READ : element_access(w, p);
+    case CXCursor_CompoundAssignOperator:
+        return is_first_child(parent, child) ? READ_WRITE : READ;
+    case CXCursor_UnaryOperator: {
+        const auto op = operator_spelling(w.tu, parent);
+        if (op == "++" || op == "--") {
+            return READ_WRITE;
+        }
+        if (op == "&") {
+            return pointer_access(w, p);
+        }
+        // an element of a multi-dimensional array
+        return op == "*" ? element_access(w, p) : READ;
+    }
+    case CXCursor_ArraySubscriptExpr:
+        return is_first_child(parent, child) ? element_access(w, p) : READ;
+    case CXCursor_CallExpr: {
+        const auto access = call_arg_access(w, p);
+        return access.write ? access : READ;
+    }
+    case CXCursor_VarDecl:
+        return is_mutable_reference(clang_getCursorType(parent)) ? READ_WRITE
+                                                                 : READ;
+    case CXCursor_CStyleCastExpr:
+    case CXCursor_CXXStaticCastExpr:
+    case CXCursor_CXXFunctionalCastExpr:
+        // a cast to a reference is still the element
+        return is_mutable_reference(clang_getCursorType(parent)) ? READ_WRITE
+                                                                 : READ;
+    case CXCursor_ReturnStmt:
+    case CXCursor_IfStmt:
+    case CXCursor_WhileStmt:
+    case CXCursor_DoStmt:
+    case CXCursor_ForStmt:
+    case CXCursor_SwitchStmt:
+    case CXCursor_CompoundStmt:
+    case CXCursor_InitListExpr:
+        return READ;
+    case CXCursor_UnaryExpr:
+        // sizeof
+        return NO_ACCESS;
+    default:
+        // an lvalue we don't follow may be assigned
+        return READ_WRITE;
+    }
+}
+
+// stack[i] evaluates to a pointer into the buffer
+BufferAccess pointer_access(Walk &w, size_t i)
+{
+    for (;;) {
+        const size_t p = parent_index(w.stack, i);
+        if (p == NO_PARENT) {
+            return NO_ACCESS;
+        }
+        const CXCursor parent = w.stack[p], child = w.stack[p + 1];
+        switch (clang_getCursorKind(parent)) {
+        case CXCursor_ArraySubscriptExpr:
+            return is_first_child(parent, child) ? element_access(w, p)
+                                                 : READ_WRITE;
+        case CXCursor_UnaryOperator: {
+            const auto op = operator_spelling(w.tu, parent);
+            if (op == "*") {
+                return element_access(w, p);
+            }
+            // only the pointer itself
+            if (op == "!" || op == "++" || op == "--") {
+                return NO_ACCESS;
+            }
+            return READ_WRITE;
+        }
+        case CXCursor_BinaryOperator: {
+            const auto op = operator_spelling(w.tu, parent);
+            // (0, p) is still the pointer
+            if (op == ",") {
+                if (is_first_child(parent, child)) {
+                    return NO_ACCESS;
+                }
+                i = p;
+                continue;
+            }
+            // libclang types p + n with an array parameter p as the array
+            const auto kind =
+                clang_getCanonicalType(clang_getCursorType(parent)).kind;
+            if ((op == "+" || op == "-") &&
+                (kind == CXType_Pointer || kind == CXType_ConstantArray ||
+                 kind == CXType_IncompleteArray)) {
+                i = p;
+                continue;
+            }
+            static const std::unordered_set<std::string> pointer_only = {
+                "-", "==", "!=", "<", ">", "<=", ">=", "&&", "||"};
+            if (pointer_only.count(op) != 0 ||
+                (op == "=" && is_first_child(parent, child))) {
+                return NO_ACCESS;
+            }
+            // stored somewhere we don't follow
+            return READ_WRITE;
+        }
+        case CXCursor_CompoundAssignOperator:
+            return is_first_child(parent, child) ? NO_ACCESS : READ_WRITE;
+        case CXCursor_ConditionalOperator:
+            if (is_first_child(parent, child)) {
+                return NO_ACCESS;
+            }
+            i = p;
+            continue;
+        case CXCursor_CStyleCastExpr:
+        case CXCursor_CXXStaticCastExpr:
+        case CXCursor_CXXReinterpretCastExpr:
+        case CXCursor_CXXConstCastExpr:
+        case CXCursor_CXXFunctionalCastExpr:
+            if (!is_pointer(clang_getCursorType(parent))) {
+                return READ_WRITE;
+            }
+            i = p;
+            continue;
+        case CXCursor_VarDecl:
+            if (!is_pointer(clang_getCursorType(parent))) {
+                return READ_WRITE;
+            }
+            // a local alias, its uses are followed too
+            w.tracked.emplace_back(parent, w.param);
+            return NO_ACCESS;
+        case CXCursor_CallExpr:
+            return call_arg_access(w, p);
+        case CXCursor_UnaryExpr:
+            // sizeof
+            return NO_ACCESS;
+        default:
+            return READ_WRITE;
+        }
+    }
+}
+
+// code clang couldn't make sense of is missing from the AST, e.g. a loop
+// over a container whose header wasn't found, and its writes with it
+bool has_errors(CXTranslationUnit tu)
+{
+    for (unsigned i = 0; i < clang_getNumDiagnostics(tu); ++i) {
+        const CXDiagnostic diag = clang_getDiagnostic(tu, i);
+        const auto severity = clang_getDiagnosticSeverity(diag);
+        clang_disposeDiagnostic(diag);
+        if (severity >= CXDiagnostic_Error) {
+            return true;
+        }
+    }
+    return false;
+}
+
+CXChildVisitResult visit(CXCursor cursor, CXCursor, CXClientData data)
+{
+    auto &w = *static_cast<Walk *>(data);
+    w.stack.push_back(cursor);
+    if (clang_getCursorKind(cursor) == CXCursor_DeclRefExpr) {
+        const auto ref = clang_getCursorReferenced(cursor);
+        for (size_t k = 0; k < w.tracked.size(); ++k) {
+            if (!clang_equalCursors(w.tracked[k].first, ref)) {
+                continue;
+            }
+            w.param = w.tracked[k].second;
+            const auto access = pointer_access(w, w.stack.size() - 1);
+            w.res[w.param].read |= access.read;
+            w.res[w.param].write |= access.write;
+            break;
+        }
+    }
+    clang_visitChildren(cursor, visit, data);
+    w.stack.pop_back();
+    return CXChildVisit_Continue;
+}
+
+}  // namespace
+
+std::vector<BufferAccess> analyze_buffer_access(CXCursor func)
+{
+    const int n = clang_Cursor_getNumArguments(func);
+    Walk w;
+    w.tu = clang_Cursor_getTranslationUnit(func);
+    w.res.resize(std::max(n, 0));
+    for (int i = 0; i < n; ++i) {
+        const CXCursor arg = clang_Cursor_getArgument(func, i);
+        const auto kind = clang_getCanonicalType(clang_getCursorType(arg)).kind;
+        if (kind == CXType_Pointer || kind == CXType_ConstantArray ||
+            kind == CXType_IncompleteArray) {
+            w.tracked.emplace_back(arg, i);
+        }
+    }
+
+    CXCursor body = clang_getNullCursor();
+    for (const auto &c : children(func)) {
+        if (clang_getCursorKind(c) == CXCursor_CompoundStmt) {
+            body = c;
+        }
+    }
+    if (clang_Cursor_isNull(body) || has_errors(w.tu)) {
+        // a declaration or a broken parse, nothing known
+        DTEE_LOG_DEBUG("NO BUFFER ACCESS ANALYSIS FOR %s\n",
+                       spelling(clang_getCursorSpelling(func)).c_str());
+        for (const auto &[arg, i] : w.tracked) {
+            w.res[i] = READ_WRITE;
+        }
+        return w.res;
+    }
+    w.stack.push_back(body);
+    clang_visitChildren(body, visit, &w);
+    return w.res;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <clang-c/Index.h>
+#include <vector>
+
+// what a function body does to the buffer a parameter points to
+struct BufferAccess {
+  bool read = false;
+  bool write = false;
+};
+
+/// @brief find how the body of the function definition func accesses the
+/// buffers its pointer and array parameters point to, one entry per
+/// parameter. Non-pointer parameters are left as no access.
+///
+/// Writes through the pointer (p[i] = x, *p = x, ++p[i], also through a
+/// conditional or comma like (c ? p[i] : y) = x), passing it as a mutable
+/// pointer or reference, or storing it are writes. Uses it can't follow
+/// (casts to other mutable pointers, aliases, unknown callees, an element
+/// used anywhere but as a plain value) count as read and write, so a buffer is only reported read-only if that's
+/// certain. Mutable iterators passed to a few std algorithms and containers
+/// known to only read them are reads.
+std::vector<BufferAccess> analyze_buffer_access(CXCursor func);
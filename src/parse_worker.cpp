@@ -0,0 +1,553 @@
+#include "parse_worker.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+
+#include "pch.h"
+
+namespace {
+
+bool write_all(int fd, const char *data, size_t size)
+{
+    while (size != 0) {
+        const ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool read_all(int fd, char *data, size_t size)
+{
+    while (size != 0) {
+        const ssize_t n = read(fd, data, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// a frame is a 32 bit length and the payload
+bool send_frame(int fd, const std::string &payload)
+{
+    const uint32_t size = payload.size();
+    return write_all(fd, reinterpret_cast<const char *>(&size), sizeof(size)) &&
+           write_all(fd, payload.data(), payload.size());
+}
+
+bool recv_frame(int fd, std::string &payload)
+{
+    uint32_t size;
+    if (!read_all(fd, reinterpret_cast<char *>(&size), sizeof(size))) {
+        return false;
+    }
+    payload.resize(size);
+    return read_all(fd, payload.data(), size);
+}
+
+class Encoder
+{
+public:
+    void u8(uint8_t v) { buf.push_back(static_cast<char>(v)); }
+    void u32(uint32_t v)
+    {
+        buf.append(reinterpret_cast<const char *>(&v), sizeof(v));
+    }
+    void str(const std::string &s)
+    {
+        u32(s.size());
+        buf += s;
+    }
+    template <typename Container>
+    void strs(const Container &c)
+    {
+        u32(c.size());
+        for (const auto &s : c) {
+            str(s);
+        }
+    }
+    void func(const FunctionInfo &f)
+    {
+        str(f.name);
+        str(f.returnType);
+        str(f.body);
+        str(f.definition);
+        strs(f.callees);
+        u8(f.c_linkage);
+        u32(f.parameters.size());
+        for (const auto &p : f.parameters) {
+            str(p.type);
+            str(p.name);
+            u32(static_cast<uint32_t>(p.array_size));
+            u8(p.is_in | p.is_out << 1 | p.is_ptr << 2 | p.is_array << 3 |
+               p.is_count << 4 | p.is_shared << 5 | p.is_stream << 6);
+            str(p.type_header);
+        }
+    }
+
+    std::string buf;
+};
+
+class Decoder
+{
+public:
+    explicit Decoder(const std::string &buf) : buf_(buf) {}
+
+    bool ok() const { return ok_; }
+
+    uint8_t u8()
+    {
+        if (!need(1)) {
+            return 0;
+        }
+        return static_cast<uint8_t>(buf_[pos_++]);
+    }
+    uint32_t u32()
+    {
+        uint32_t v = 0;
+        if (need(sizeof(v))) {
+            memcpy(&v, buf_.data() + pos_, sizeof(v));
+            pos_ += sizeof(v);
+        }
+        return v;
+    }
+    std::string str()
+    {
+        const uint32_t size = u32();
+        if (!need(size)) {
+            return "";
+        }
+        pos_ += size;
+        return buf_.substr(pos_ - size, size);
+    }
+    std::vector<std::string> strs()
+    {
+        std::vector<std::string> res(u32());
+        for (auto &s : res) {
+            s = str();
+        }
+        return res;
+    }
+    FunctionInfo func()
+    {
+        FunctionInfo f;
+        f.name = str();
+        f.returnType = str();
+        f.body = str();
+        f.definition = str();
+        f.callees = strs();
+        f.c_linkage = u8();
+        f.parameters.resize(u32());
+        for (auto &p : f.parameters) {
+            p.type = str();
+            p.name = str();
+            p.array_size = static_cast<int>(u32());
+            const uint8_t flags = u8();
+            p.is_in = flags & 1;
+            p.is_out = flags & 2;
+            p.is_ptr = flags & 4;
+            p.is_array = flags & 8;
+            p.is_count = flags & 16;
+            p.is_shared = flags & 32;
+            p.is_stream = flags & 64;
+            p.type_header = str();
+        }
+        return f;
+    }
+
+private:
+    bool need(size_t n)
+    {
+        ok_ = ok_ && buf_.size() - pos_ >= n;
+        return ok_;
+    }
+
+    const std::string &buf_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+std::string describe_status(int status)
+{
+    if (WIFSIGNALED(status)) {
+        return std::string("killed by ") + strsignal(WTERMSIG(status));
+    }
+    if (WIFEXITED(status)) {
+        return "exited with " + std::to_string(WEXITSTATUS(status));
+    }
+    return "stopped";
+}
+
+std::string self_exe()
+{
+    char path[PATH_MAX];
+    const ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    ASSERT(n > 0, "Unable to find dteegen executable: %s", strerror(errno));
+    path[n] = '\0';
+    return path;
+}
+
+// workers log at the level of the parent
+const char *log_level_flag()
+{
+    switch (dtee_log::g_runtime_level.load()) {
+    case dtee_log::Level::Trace:
+        return "-vv";
+    case dtee_log::Level::Debug:
+        return "-v";
+    case dtee_log::Level::Info:
+        return nullptr;
+    default:
+        return "-q";
+    }
+}
+
+}  // namespace
+
+ParseWorkerPool::ParseWorkerPool(size_t workers, size_t mem_limit_mb,
+                                 size_t retries, size_t timeout_s)
+    : workers_(workers),
+      mem_limit_mb_(mem_limit_mb),
+      retries_(retries),
+      timeout_s_(timeout_s)
+{
+    // a worker dying while we write to it must not kill us
+    signal(SIGPIPE, SIG_IGN);
+    for (auto &w : workers_) {
+        spawn(w);
+    }
+    DTEE_LOG("Created %zu parse workers\n", workers);
+}
+
+ParseWorkerPool::~ParseWorkerPool()
+{
+    // workers exit when their request pipe closes
+    for (auto &w : workers_) {
+        close(w.to);
+        close(w.from);
+    }
+    for (auto &w : workers_) {
+        int status;
+        waitpid(w.pid, &status, 0);
+    }
+}
+
+void ParseWorkerPool::spawn(Worker &w)
+{
+    static const std::string exe = self_exe();
+    int req[2], resp[2];
+    ASSERT(pipe2(req, O_CLOEXEC) == 0 && pipe2(resp, O_CLOEXEC) == 0,
+           "Unable to create pipe: %s", strerror(errno));
+
+    // everything the child needs is prepared before fork, it may only call
+    // async signal safe functions until exec
+    std::vector<char *> argv = {const_cast<char *>(exe.c_str()),
+                                const_cast<char *>("--parse-worker")};
+    if (const char *flag = log_level_flag()) {
+        argv.push_back(const_cast<char *>(flag));
+    }
+    argv.push_back(nullptr);
+    const rlim_t mem_limit = static_cast<rlim_t>(mem_limit_mb_) << 20;
+
+    const pid_t pid = fork();
+    ASSERT(pid >= 0, "Unable to fork parse worker: %s", strerror(errno));
+    if (pid == 0) {
+        if (mem_limit != 0) {
+            const rlimit limit = {mem_limit, mem_limit};
+            setrlimit(RLIMIT_AS, &limit);
+        }
+        dup2(req[0], STDIN_FILENO);
+        dup2(resp[1], STDOUT_FILENO);
+        execv(exe.c_str(), argv.data());
+        _exit(127);
+    }
+    close(req[0]);
+    close(resp[1]);
+    w.pid = pid;
+    w.to = req[1];
+    w.from = resp[0];
+    w.file.clear();
+
+    // a failure shows up on the first request
+    if (!calls_frame_.empty()) {
+        send_frame(w.to, calls_frame_);
+    }
+}
+
+void ParseWorkerPool::reap(Worker &w)
+{
+    close(w.to);
+    close(w.from);
+    kill(w.pid, SIGKILL);
+    int status = 0;
+    waitpid(w.pid, &status, 0);
+    DTEE_LOG_WARN("parse worker %d %s while parsing %s\n", w.pid,
+                  describe_status(status).c_str(), w.file.c_str());
+}
+
+void ParseWorkerPool::set_calls(
+    const std::unordered_set<FuncName> &insecure_world,
+    const std::unordered_set<FuncName> &secure_world)
+{
+    Encoder req;
+    req.u8(static_cast<uint8_t>(ParseRequest::SetCalls));
+    req.strs(insecure_world);
+    req.strs(secure_world);
+    calls_frame_ = std::move(req.buf);
+    for (auto &w : workers_) {
+        send_frame(w.to, calls_frame_);
+    }
+}
+
+void ParseWorkerPool::run(
+    ParseRequest request, const std::vector<std::string> &files,
+    const std::function<void(const std::string &, FileSummary &&)> &on_done)
+{
+    // file, times it was tried
+    std::deque<std::pair<std::string, size_t>> queue;
+    for (const auto &f : files) {
+        queue.emplace_back(f, 0);
+    }
+    std::unordered_map<std::string, size_t> tries;
+
+    size_t busy = 0;
+    const auto worker_died = [&](size_t i) {
+        auto &w = workers_[i];
+        reap(w);
+        // its translation units died with it, what they read is in read_
+        for (auto it = affinity_.begin(); it != affinity_.end();) {
+            it = it->second == i ? affinity_.erase(it) : std::next(it);
+        }
+        const size_t n = ++tries[w.file];
+        if (n <= retries_) {
+            queue.emplace_front(w.file, n);
+        }
+        else {
+            DTEE_LOG_ERROR("Giving up on %s after %zu attempts\n",
+                           w.file.c_str(), n);
+            if (std::find(failed_.begin(), failed_.end(), w.file) ==
+                failed_.end()) {
+                failed_.push_back(w.file);
+            }
+        }
+        --busy;
+        spawn(w);
+    };
+
+    while (!queue.empty() || busy != 0) {
+        for (size_t i = 0; i < workers_.size() && !queue.empty(); ++i) {
+            auto &w = workers_[i];
+            if (!w.file.empty()) {
+                continue;
+            }
+            // prefer files whose translation unit this worker has, then
+            // files nobody parsed yet
+            auto it = std::find_if(queue.begin(), queue.end(), [&](auto &q) {
+                const auto a = affinity_.find(q.first);
+                return a != affinity_.end() && a->second == i;
+            });
+            if (it == queue.end()) {
+                it = std::find_if(queue.begin(), queue.end(), [&](auto &q) {
+                    return affinity_.count(q.first) == 0;
+                });
+            }
+            if (it == queue.end()) {
+                it = queue.begin();
+            }
+            w.file = it->first;
+            queue.erase(it);
+            ++busy;
+            w.deadline = std::chrono::steady_clock::now() +
+                         std::chrono::seconds(timeout_s_);
+
+            Encoder req;
+            req.u8(static_cast<uint8_t>(request));
+            req.str(w.file);
+            if (!send_frame(w.to, req.buf)) {
+                worker_died(i);
+            }
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<size_t> index;
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            if (!workers_[i].file.empty()) {
+                fds.push_back({workers_[i].from, POLLIN, 0});
+                index.push_back(i);
+            }
+        }
+        if (fds.empty()) {
+            continue;
+        }
+        // wake up for the first deadline, a worker past it is hung
+        int timeout_ms = -1;
+        if (timeout_s_ != 0) {
+            const auto now = std::chrono::steady_clock::now();
+            auto first = workers_[index[0]].deadline;
+            for (const size_t i : index) {
+                first = std::min(first, workers_[i].deadline);
+            }
+            const auto left =
+                std::chrono::duration_cast<std::chrono::milliseconds>(first -
+                                                                      now);
+            timeout_ms = static_cast<int>(
+                std::max<int64_t>(left.count() + 1, 0));
+        }
+        const int ready = poll(fds.data(), fds.size(), timeout_ms);
+        if (ready < 0) {
+            ASSERT(errno == EINTR, "poll failed: %s", strerror(errno));
+            continue;
+        }
+        if (ready == 0) {
+            const auto now = std::chrono::steady_clock::now();
+            for (const size_t i : index) {
+                if (workers_[i].deadline <= now) {
+                    DTEE_LOG_WARN("parse worker %d took over %zus on %s\n",
+                                  workers_[i].pid, timeout_s_,
+                                  workers_[i].file.c_str());
+                    worker_died(i);
+                }
+            }
+            continue;
+        }
+
+        for (size_t k = 0; k < fds.size(); ++k) {
+            if (fds[k].revents == 0) {
+                continue;
+            }
+            const size_t i = index[k];
+            auto &w = workers_[i];
+            std::string frame;
+            if (!recv_frame(w.from, frame)) {
+                worker_died(i);
+                continue;
+            }
+
+            Decoder reply(frame);
+            FileSummary summary;
+            if (request == ParseRequest::Calls) {
+                summary.calls = reply.strs();
+            }
+            else if (request == ParseRequest::Symbols) {
+                summary.symbols.defines = reply.strs();
+                summary.symbols.references = reply.strs();
+                summary.symbols.has_static_init = reply.u8();
+            }
+            else {
+                summary.funcs.resize(reply.u32());
+                for (auto &f : summary.funcs) {
+                    f = reply.func();
+                }
+            }
+            for (auto &f : reply.strs()) {
+                read_.insert(std::move(f));
+            }
+            ASSERT(reply.ok(), "Malformed reply from parse worker %d", w.pid);
+
+            affinity_[w.file] = i;
+            const auto file = std::move(w.file);
+            w.file.clear();
+            --busy;
+            on_done(file, std::move(summary));
+        }
+    }
+}
+
+std::vector<std::string> ParseWorkerPool::parsed_files() const
+{
+    return {read_.begin(), read_.end()};
+}
+
+int parse_worker_main()
+{
+    // stdout carries the replies, logs go to stderr
+    const int out = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    // main files whose inclusions were sent, a cached translation unit
+    // reads nothing new
+    std::unordered_set<std::string> reported;
+    std::string frame;
+    while (recv_frame(STDIN_FILENO, frame)) {
+        Decoder in(frame);
+        const auto request = static_cast<ParseRequest>(in.u8());
+        const std::string file =
+            request == ParseRequest::SetCalls ? "" : in.str();
+        Encoder reply;
+        switch (request) {
+        case ParseRequest::SetCalls: {
+            const auto insecure_world = in.strs();
+            const auto secure_world = in.strs();
+            g_func_calls_in_insecure_world = {insecure_world.begin(),
+                                              insecure_world.end()};
+            g_func_calls_in_secure_world = {secure_world.begin(),
+                                            secure_world.end()};
+            // no reply
+            continue;
+        }
+        case ParseRequest::Calls: {
+            FileContext f_ctx{.file_path = file};
+            parse_file(f_ctx, func_call_collect_visitor);
+            reply.strs(tls_func_calls_each_file);
+            tls_func_calls_each_file.clear();
+            break;
+        }
+        case ParseRequest::SecureEntries:
+        case ParseRequest::InsecureEntries: {
+            FileContext f_ctx{.file_path = file};
+            parse_file(f_ctx, request == ParseRequest::SecureEntries
+                                  ? secure_world_entry_func_def_collect_visitor
+                                  : insecure_world_entry_func_def_collect_visitor);
+            reply.u32(tls_func_list_each_file.size());
+            for (const auto &f : tls_func_list_each_file) {
+                reply.func(f);
+            }
+            tls_func_list_each_file.clear();
+            break;
+        }
+        case ParseRequest::Symbols: {
+            TuSymbols symbols;
+            const bool parsed = collect_symbols(file, symbols);
+            reply.strs(symbols.defines);
+            reply.strs(symbols.references);
+            // a file which couldn't be parsed is kept like one with static
+            // initializers
+            reply.u8(!parsed || symbols.has_static_init);
+            break;
+        }
+        }
+        ASSERT(in.ok(), "Malformed parse request");
+        // what the file read, for the depfile. Kept by the parent as it
+        // arrives, so it outlives this worker
+        reply.strs(reported.insert(file).second ? parsed_files(file)
+                                                : std::vector<std::string>());
+        dtee_log::flush();
+        if (!send_frame(out, reply.buf)) {
+            return 1;
+        }
+    }
+    return 0;
+}
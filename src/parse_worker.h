@@ -0,0 +1,96 @@
+#pragma once
+#include <chrono>
+#include <functional>
+
+#include "parser.h"
+#include "reachability.h"
+
+// what a worker is asked to do with a file
+enum class ParseRequest : char {
+  // collect the funcs called (or declared) in the file
+  Calls = 'C',
+  // collect the entry funcs defined in a secure/insecure file
+  SecureEntries = 'S',
+  InsecureEntries = 'I',
+  // collect the symbols an enclave source defines and references
+  Symbols = 'Y',
+  // internal: replace the call sets entry funcs are matched against
+  SetCalls = 'W',
+};
+
+// what parsing one file produced
+struct FileSummary {
+  std::vector<std::string> calls;
+  std::vector<FunctionInfo> funcs;
+  TuSymbols symbols;
+};
+
+/// @brief parses files in worker processes instead of threads. libclang keeps
+/// global state and one malformed file can crash it or hit an ASSERT, both
+/// only take a worker down here: the file is retried on a fresh worker, and
+/// reported as failed if it keeps failing. A worker which takes too long on
+/// a file is killed and counts as crashed.
+///
+/// Workers are dteegen itself exec()ed in --parse-worker mode, talking
+/// length prefixed frames over a pipe pair. A file is preferably sent to
+/// the worker which parsed it before, which has its translation unit
+/// cached.
+class ParseWorkerPool {
+public:
+  /// @param workers number of worker processes
+  /// @param mem_limit_mb address space cap of each worker, 0 for none
+  /// @param retries times a file is retried after its worker died
+  /// @param timeout_s seconds a worker may spend on a file, 0 for no limit
+  ParseWorkerPool(size_t workers, size_t mem_limit_mb, size_t retries,
+                  size_t timeout_s);
+  ~ParseWorkerPool();
+
+  ParseWorkerPool(const ParseWorkerPool &) = delete;
+  ParseWorkerPool &operator=(const ParseWorkerPool &) = delete;
+
+  /// @brief call sets entry funcs are matched against, sent to every worker
+  /// (including ones started later) before entry requests
+  void set_calls(const std::unordered_set<FuncName> &insecure_world,
+                 const std::unordered_set<FuncName> &secure_world);
+
+  /// @brief parse files, on_done is called in the calling thread as results
+  /// arrive. Files which failed are left out.
+  void run(ParseRequest request, const std::vector<std::string> &files,
+           const std::function<void(const std::string &, FileSummary &&)>
+               &on_done);
+
+  /// @brief files libclang read for the files parsed so far, also by workers
+  /// which died since
+  std::vector<std::string> parsed_files() const;
+
+  /// @brief files given up on so far
+  const std::vector<std::string> &failed() const { return failed_; }
+
+private:
+  struct Worker {
+    pid_t pid = -1;
+    int to = -1;
+    int from = -1;
+    // file being parsed, empty if idle
+    std::string file;
+    // when the worker is given up on if it didn't reply
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  void spawn(Worker &w);
+  void reap(Worker &w);
+
+  std::vector<Worker> workers_;
+  size_t mem_limit_mb_;
+  size_t retries_;
+  size_t timeout_s_;
+  std::string calls_frame_;
+  // file -> worker which parsed it last
+  std::unordered_map<std::string, size_t> affinity_;
+  std::vector<std::string> failed_;
+  // what the replies said libclang read
+  std::unordered_set<std::string> read_;
+};
+
+/// @brief main loop of a worker process, serving requests on stdin
+int parse_worker_main();
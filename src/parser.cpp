@@ -3,7 +3,10 @@
 #include "clang-c/CXString.h"
 #include "clang-c/Index.h"
 #include "fs.h"
+#include "libclang.h"
+#include "param_access.h"
 #include "pch.h"
+#include "purity.h"
 
 std::string getCursorSpelling(const CXCursor &cursor)
 {
@@ -33,14 +36,63 @@ std::string getFunctionReturnType(CXCursor cursor)
     return getTypeSpelling(returnType);
 }
 
+// file declaring cursor
+std::string get_declaring_file(CXCursor cursor)
+{
+    CXFile file = nullptr;
+    clang_getSpellingLocation(clang_getCursorLocation(cursor), &file, nullptr,
+                              nullptr, nullptr);
+    if (file == nullptr) {
+        return "";
+    }
+    CXString name = clang_getFileName(file);
+    std::string res = clang_getCString(name);
+    clang_disposeString(name);
+    return res;
+}
+
+// type of a buffer element or a by value param as the EDL, and the C code
+// generated from it, spell it. header is set to the file declaring it if
+// it's a user type. Only types which can be copied across bytewise are
+// accepted.
+std::string get_marshalled_type(CXType type, std::string &header)
+{
+    const auto canonical = clang_getCanonicalType(type);
+    const std::string qualifier =
+        clang_isConstQualifiedType(type) ? "const " : "";
+    if (canonical.kind >= CXType_Bool && canonical.kind <= CXType_LongDouble) {
+        // typedefs of builtins are resolved, the EDL doesn't know them
+        return getTypeSpelling(canonical);
+    }
+
+    const auto spell = getTypeSpelling(type);
+    ASSERT(canonical.kind == CXType_Enum ||
+               (canonical.kind == CXType_Record && clang_isPODType(canonical)),
+           "Invalid element type: %s, only arithmetic types, enums and "
+           "trivially copyable structs can cross the boundary",
+           spell.c_str());
+    const CXCursor decl = clang_getTypeDeclaration(type);
+    header = get_declaring_file(decl);
+    if (clang_getCursorKind(decl) == CXCursor_TypedefDecl) {
+        return qualifier + getCursorSpelling(decl);
+    }
+    // the generated code is C, which needs the tag
+    switch (clang_getCursorKind(decl)) {
+    case CXCursor_UnionDecl:
+        return qualifier + "union " + getCursorSpelling(decl);
+    case CXCursor_EnumDecl:
+        return qualifier + "enum " + getCursorSpelling(decl);
+    default:
+        return qualifier + "struct " + getCursorSpelling(decl);
+    }
+}
+
 std::vector<Param> getFunctionParameters(CXCursor cursor)
 {
     int numArgs = clang_Cursor_getNumArguments(cursor);
     std::vector<Param> parameters(numArgs);
-    // check parameters validity
-    static const std::unordered_set<std::string> valid_element_type = {
-        "char", "in_char", "out_char"};
 
+    // check parameters validity
     std::string next_arg_name;
     for (int i = numArgs - 1; i >= 0; --i) {
         CXCursor arg = clang_Cursor_getArgument(cursor, i);
@@ -52,13 +104,12 @@ std::vector<Param> getFunctionParameters(CXCursor cursor)
             parameters[i].is_ptr = true;
             ASSERT(i != numArgs - 1, "last parameter can't be a pointer!");
 
-            const CXType ele_type = clang_getPointeeType(type);
-            const auto spell = getTypeSpelling(ele_type);
-            ASSERT(valid_element_type.count(spell) != 0,
-                   "Invalid element type: %s", spell.c_str());
-            ASSERT(next_arg_name == arg_name + "_len",
-                   "Invalid array length name: %s, should be %s_len",
-                   next_arg_name.c_str(), next_arg_name.c_str());
+            // a buffer is followed by its size in bytes, or by its number
+            // of elements
+            parameters[i].is_count = next_arg_name == arg_name + "_cnt";
+            ASSERT(parameters[i].is_count || next_arg_name == arg_name + "_len",
+                   "Invalid array length name: %s, should be %s_len or %s_cnt",
+                   next_arg_name.c_str(), arg_name.c_str(), arg_name.c_str());
         }
         else {
             parameters[i].is_ptr = false;
@@ -66,6 +117,8 @@ std::vector<Param> getFunctionParameters(CXCursor cursor)
         next_arg_name = arg_name;
     }
 
+    // analyzed on first need, most entry funcs take no buffers
+    std::vector<BufferAccess> access;
     for (int i = 0; i < numArgs; ++i) {
         CXCursor arg = clang_Cursor_getArgument(cursor, i);
 
@@ -76,8 +129,6 @@ std::vector<Param> getFunctionParameters(CXCursor cursor)
          */
         /*        "arr[32]) instead of pointer " */
         /*        "(e.g. char *arr or char arr[])"); */
-        bool is_in = true, is_out = true;
-
         auto &p = parameters[i];
         p.type = getTypeSpelling(type);
         p.name = getCursorSpelling(arg);
@@ -89,21 +140,59 @@ std::vector<Param> getFunctionParameters(CXCursor cursor)
             if (p.is_array) {
                 p.array_size = clang_getArraySize(type);
                 pointee_type = clang_getArrayElementType(type);
+                // char arrays keep size=, it's the same
+                p.is_count = clang_Type_getSizeOf(pointee_type) != 1;
             }
             else if (p.is_ptr) {
                 pointee_type = clang_getPointeeType(type);
             }
             else {
+                p.is_stream = p.type == "dtee_stream";
+                if (p.is_stream) {
+                    // what the typedef in z_stream.h says, the stubs don't
+                    // see the project's
+                    p.type = "int";
+                }
+                // structs and enums are copied by value
+                const auto kind = clang_getCanonicalType(type).kind;
+                if (kind == CXType_Record || kind == CXType_Enum) {
+                    p.type = get_marshalled_type(type, p.type_header);
+                }
                 break;
             }
 
             auto pointee = getTypeSpelling(pointee_type);
 
-            // TODO: this is just a trick to determine in and out
-            p.is_in = pointee == "in_char";
+            // in_char/out_char say it explicitly, otherwise a buffer the
+            // body never writes to needn't be copied back
+            p.is_in = pointee == "in_char" ||
+                      clang_isConstQualifiedType(pointee_type);
             p.is_out = pointee == "out_char";
-            if (p.is_in || p.is_out) {
+            p.is_shared = pointee == "shared_char";
+            if (pointee == "in_char" || pointee == "out_char") {
+                pointee = "char";
+            }
+            else if (p.is_shared) {
+                // the direction only matters where the host stages it
                 pointee = "char";
+                if (access.empty()) {
+                    access = analyze_buffer_access(cursor);
+                }
+                p.is_in = !access[i].write;
+            }
+            else {
+                pointee = get_marshalled_type(pointee_type, p.type_header);
+                if (!p.is_in) {
+                    if (access.empty()) {
+                        access = analyze_buffer_access(cursor);
+                    }
+                    p.is_in = !access[i].write;
+                    if (p.is_in) {
+                        DTEE_LOG("NARROWED %s(%s) TO [in]: not written\n",
+                                 getCursorSpelling(cursor).c_str(),
+                                 p.name.c_str());
+                    }
+                }
             }
 
             p.type = pointee + "*";
@@ -149,6 +238,36 @@ std::string get_function_body(CXCursor cursor, const std::string &filepath)
     return function_body;
 }
 
+// an insecure entry func which touches nothing but its parameters may run
+// in the enclave, keep its source for that
+void set_relocatable_definition(CXCursor cursor, const std::string &filepath,
+                                FunctionInfo &func)
+{
+    if (has_annotation(cursor, KEEP_OCALL_ANNOTATION)) {
+        DTEE_LOG_DEBUG("%s STAYS AN OCALL: annotated\n", func.name.c_str());
+        return;
+    }
+    auto purity = analyze_purity(cursor);
+    if (!purity.pure) {
+        DTEE_LOG_DEBUG("%s STAYS AN OCALL: %s\n", func.name.c_str(),
+                       purity.reason.c_str());
+        return;
+    }
+
+    const CXSourceRange range = clang_getCursorExtent(cursor);
+    unsigned start = 0, end = 0;
+    clang_getSpellingLocation(clang_getRangeStart(range), nullptr, nullptr,
+                              nullptr, &start);
+    clang_getSpellingLocation(clang_getRangeEnd(range), nullptr, nullptr,
+                              nullptr, &end);
+    func.definition = read_file(filepath).substr(start, end - start);
+    func.callees = std::move(purity.callees);
+    // a C++ linkage name is mangled
+    CXString mangled = clang_Cursor_getMangling(cursor);
+    func.c_linkage = func.name == clang_getCString(mangled);
+    clang_disposeString(mangled);
+}
+
 // an entry func is a func defined in one world and called in another world
 template <WorldType world_type_visited>
 CXChildVisitResult entry_func_def_collect_visitor(
@@ -166,7 +285,7 @@ CXChildVisitResult entry_func_def_collect_visitor(
 
     if (kind == CXCursor_FunctionDecl) {
         auto func_name = getCursorSpelling(cursor);
-        DTEE_LOG("VISITING %s IN %s WORLD\n", func_name.c_str(), world_type_visited == WorldType::INSECURE_WORLD ? "INSECURE" : "SECURE");
+        DTEE_LOG_TRACE("VISITING %s IN %s WORLD\n", func_name.c_str(), world_type_visited == WorldType::INSECURE_WORLD ? "INSECURE" : "SECURE");
 
         bool is_def_valid;
 
@@ -195,6 +314,12 @@ CXChildVisitResult entry_func_def_collect_visitor(
             funcInfo.body = get_function_body(cursor, file_ctx.file_path);
 
             // if body is not empty, then it is a definition
+            if constexpr (world_type_visited == WorldType::INSECURE_WORLD) {
+                if (!funcInfo.body.empty()) {
+                    set_relocatable_definition(cursor, file_ctx.file_path,
+                                               funcInfo);
+                }
+            }
             if (!funcInfo.body.empty()) {
                 tls_func_list_each_file.push_back(std::move(funcInfo));
             }
@@ -259,7 +384,7 @@ struct TranslationUnitManager
         if (unit == nullptr) {
             std::cerr << "Unable to parse translation unit: " << file_path
                       << std::endl;
-            return {};
+            return clang_getNullCursor();
         }
 
         std::scoped_lock<std::shared_mutex> lock(rw_mutex);
@@ -287,11 +412,55 @@ struct TranslationUnitManager
 
 } manager;
 
-void parse_file(const FileContext &file_ctx, VISITOR visitor)
+bool parse_file(const FileContext &file_ctx, VISITOR visitor)
 {
     CXCursor cursor = manager.get_cursor(file_ctx.file_path.c_str());
+    if (clang_Cursor_isNull(cursor)) {
+        return false;
+    }
 
     clang_visitChildren(cursor, visitor, (void *)&file_ctx);
+    return true;
+}
+
+namespace {
+
+void add_inclusions(CXTranslationUnit unit,
+                    std::unordered_set<std::string> &files)
+{
+    clang_getInclusions(
+        unit,
+        [](CXFile included_file, CXSourceLocation *, unsigned,
+           CXClientData data) {
+            CXString name = clang_getFileName(included_file);
+            static_cast<std::unordered_set<std::string> *>(data)->insert(
+                clang_getCString(name));
+            clang_disposeString(name);
+        },
+        &files);
+}
+
+}  // namespace
+
+std::vector<std::string> parsed_files()
+{
+    std::unordered_set<std::string> files;
+    std::shared_lock<std::shared_mutex> lock(manager.rw_mutex);
+    for (const auto &[_, pair] : manager.map) {
+        add_inclusions(pair.second, files);
+    }
+    return {files.begin(), files.end()};
+}
+
+std::vector<std::string> parsed_files(const std::string &file)
+{
+    std::unordered_set<std::string> files;
+    std::shared_lock<std::shared_mutex> lock(manager.rw_mutex);
+    const auto it = manager.map.find(file);
+    if (it != manager.map.end()) {
+        add_inclusions(it->second.second, files);
+    }
+    return {files.begin(), files.end()};
 }
 
 std::string read_file_content(const std::string &filename)
@@ -15,6 +15,17 @@ struct Param {
   bool is_out;
   bool is_ptr;
   bool is_array;
+  // the buffer is sized in elements (count=), not bytes (size=)
+  bool is_count;
+  // shared_char: the buffer is in the shared region and isn't copied, see
+  // z_shared.h
+  bool is_shared = false;
+  // dtee_stream: the handle of a stream the enclave reads as the call runs,
+  // see z_stream.h
+  bool is_stream = false;
+  // header declaring the user type (struct, enum, typedef) the param uses,
+  // empty for builtin types
+  std::string type_header;
 };
 
 struct FileContext {
@@ -26,6 +37,13 @@ struct FunctionInfo {
   std::string returnType;
   std::vector<Param> parameters;
   std::string body;
+  // source of the whole definition, only set for insecure funcs which are
+  // pure (see analyze_purity) and so could run in the enclave instead
+  std::string definition;
+  // funcs the definition calls, it only moves if they do too
+  std::vector<std::string> callees;
+  // declared extern "C" or in C, the enclave copy keeps the linkage
+  bool c_linkage = true;
 };
 
 using VISITOR = CXChildVisitResult (*)(CXCursor cursor, CXCursor parent,
@@ -33,7 +51,17 @@ using VISITOR = CXChildVisitResult (*)(CXCursor cursor, CXCursor parent,
 
 std::string read_file_content(const std::string &filename);
 
-void parse_file(const FileContext &file_ctx, VISITOR visitor);
+/// @brief visit the translation unit of the file, false if libclang could
+/// not parse it
+bool parse_file(const FileContext &file_ctx, VISITOR visitor);
+
+/// @brief every file libclang read for the translation units parsed so far,
+/// the main files and whatever they include, system headers included
+std::vector<std::string> parsed_files();
+
+/// @brief the files libclang read for the translation unit of file, empty if
+/// it wasn't parsed
+std::vector<std::string> parsed_files(const std::string &file);
 
 CXChildVisitResult func_call_collect_visitor(CXCursor cursor, CXCursor parent,
                                              CXClientData clientData);
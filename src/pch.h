@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -13,6 +14,8 @@
 #include <unordered_set>
 #include <vector>
 
+#include "log.h"
+
 #define SECURE "secure"
 #define INSECURE "insecure"
 #define ENCLAVE "enclave"
@@ -21,13 +24,15 @@
 #define ENCLAVE_LIB "enclave_lib"
 #define SECURE_INCLUDE "secure_include"
 #define ENCLAVE_INCLUDE "enclave_include"
+#define ASSETS "assets"
+#define EMBED "embed"
+#define ASSET_BUNDLE "assets.bundle"
 
 enum class WorldType : uint8_t { SECURE_WORLD, INSECURE_WORLD };
 
-#define DTEE_LOG(...) printf(__VA_ARGS__)
-
 #define ASSERT(x, msg, ...)                                                    \
   if (!(x)) {                                                                  \
+    dtee_log::flush();                                                         \
     fprintf(stderr, "Assertion failed: %s, " msg "\n", #x, ##__VA_ARGS__);     \
     exit(-1);                                                                  \
   }
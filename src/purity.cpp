@@ -0,0 +1,268 @@
+#include "purity.h"
+
+#include "clang-c/CXString.h"
+#include "clang-c/Index.h"
+#include "libclang.h"
+#include "pch.h"
+
+namespace {
+
+// libc functions without side effects which any enclave libc has, the
+// generated code includes math.h and stdlib.h for them. Relocated
+// definitions use nothing else of their file's includes
+const std::unordered_set<std::string> PURE_LIBC = {
+    "abs",   "labs",   "llabs", "fabs",  "fabsf",  "sqrt",  "sqrtf",
+    "cbrt",  "cbrtf",  "pow",   "powf",  "hypot",  "hypotf", "exp",
+    "expf",  "exp2",   "exp2f", "log",   "logf",   "log2",  "log2f",
+    "log10", "log10f", "sin",   "sinf",  "cos",    "cosf",  "tan",
+    "tanf",  "asin",   "asinf", "acos",  "acosf",  "atan",  "atanf",
+    "atan2", "atan2f", "sinh",  "sinhf", "cosh",   "coshf", "tanh",
+    "tanhf", "floor",  "floorf", "ceil", "ceilf",  "round", "roundf",
+    "trunc", "truncf", "fmod",  "fmodf", "fmin",   "fminf", "fmax",
+    "fmaxf",
+};
+
+struct Walk
+{
+    CXCursor func;
+    Purity res;
+    // identifiers the AST accounts for, any other one in the source of the
+    // definition is a macro
+    std::unordered_set<std::string> names;
+};
+
+std::string spelling(CXString str)
+{
+    std::string res = clang_getCString(str);
+    clang_disposeString(str);
+    return res;
+}
+
+void impure(Walk &w, const std::string &reason)
+{
+    w.res.pure = false;
+    w.res.reason = reason;
+}
+
+// a variable of the function itself, not one it shares with others
+bool is_local(const Walk &w, CXCursor var)
+{
+    return clang_equalCursors(clang_getCursorSemanticParent(var), w.func) &&
+           clang_Cursor_getStorageClass(var) != CX_SC_Static &&
+           clang_Cursor_getStorageClass(var) != CX_SC_Extern;
+}
+
+void visit_call(Walk &w, CXCursor call)
+{
+    const CXCursor callee = clang_getCursorReferenced(call);
+    if (clang_Cursor_isNull(callee)) {
+        impure(w, "unresolved call");
+        return;
+    }
+    const auto name = spelling(clang_getCursorSpelling(callee));
+    if (clang_getCursorKind(callee) != CXCursor_FunctionDecl) {
+        impure(w, "calls " + name + ", which isn't a plain function");
+        return;
+    }
+    if (PURE_LIBC.count(name) == 0) {
+        w.res.callees.push_back(name);
+    }
+}
+
+// the definition is pasted into the enclave without the rest of its file,
+// so any type it names has to be builtin
+bool is_builtin(CXType type)
+{
+    type = clang_getCanonicalType(type);
+    switch (type.kind) {
+    case CXType_Pointer:
+        return is_builtin(clang_getPointeeType(type));
+    case CXType_ConstantArray:
+    case CXType_IncompleteArray:
+        return is_builtin(clang_getArrayElementType(type));
+    default:
+        return type.kind >= CXType_FirstBuiltin &&
+               type.kind <= CXType_LastBuiltin;
+    }
+}
+
+CXChildVisitResult purity_visitor(CXCursor cursor, CXCursor, CXClientData data)
+{
+    auto &w = *static_cast<Walk *>(data);
+    switch (clang_getCursorKind(cursor)) {
+    case CXCursor_CallExpr:
+        visit_call(w, cursor);
+        break;
+    case CXCursor_DeclRefExpr: {
+        const CXCursor ref = clang_getCursorReferenced(cursor);
+        const auto name = spelling(clang_getCursorSpelling(ref));
+        switch (clang_getCursorKind(ref)) {
+        case CXCursor_VarDecl:
+            if (!is_local(w, ref)) {
+                impure(w, "uses " + name + ", which isn't local");
+            }
+            break;
+        case CXCursor_ParmDecl:
+            break;
+        case CXCursor_FunctionDecl:
+            // taken as an address or called, it has to move along
+            if (PURE_LIBC.count(name) == 0) {
+                w.res.callees.push_back(name);
+            }
+            break;
+        default:
+            impure(w, "uses " + name + " of its file");
+            break;
+        }
+        w.names.insert(name);
+        break;
+    }
+    case CXCursor_VarDecl:
+    case CXCursor_ParmDecl:
+        if (clang_getCursorKind(cursor) == CXCursor_VarDecl &&
+            !is_local(w, cursor)) {
+            impure(w, "declares static " +
+                          spelling(clang_getCursorSpelling(cursor)));
+        }
+        else if (!is_builtin(clang_getCursorType(cursor))) {
+            impure(w, "has " + spelling(clang_getCursorSpelling(cursor)) +
+                          " of a type of its file");
+        }
+        w.names.insert(spelling(clang_getCursorSpelling(cursor)));
+        break;
+    case CXCursor_TypeRef:
+    case CXCursor_TemplateRef:
+    case CXCursor_NamespaceRef:
+        impure(w, "names " + spelling(clang_getCursorSpelling(cursor)) +
+                      ", which isn't builtin");
+        break;
+    case CXCursor_LabelStmt:
+    case CXCursor_LabelRef:
+        w.names.insert(spelling(clang_getCursorSpelling(cursor)));
+        break;
+    case CXCursor_CXXNewExpr:
+    case CXCursor_CXXDeleteExpr:
+        impure(w, "allocates");
+        break;
+    case CXCursor_CXXThrowExpr:
+        impure(w, "throws");
+        break;
+    case CXCursor_GCCAsmStmt:
+    case CXCursor_MSAsmStmt:
+        impure(w, "has inline assembly");
+        break;
+    case CXCursor_LambdaExpr:
+        // its locals aren't the function's, don't go there
+        impure(w, "has a lambda");
+        break;
+    default:
+        break;
+    }
+    return w.res.pure ? CXChildVisit_Recurse : CXChildVisit_Break;
+}
+
+unsigned offset_of(CXSourceLocation loc, CXFile *file = nullptr)
+{
+    unsigned offset = 0;
+    clang_getSpellingLocation(loc, file, nullptr, nullptr, &offset);
+    return offset;
+}
+
+// the AST of code with errors misses what clang couldn't make sense of,
+// calls included. After a fatal error (a header not found) clang reports
+// nothing more, so that's an error everywhere.
+bool has_errors(CXCursor func)
+{
+    if (clang_isInvalidDeclaration(func)) {
+        return true;
+    }
+    const CXTranslationUnit tu = clang_Cursor_getTranslationUnit(func);
+    const CXSourceRange extent = clang_getCursorExtent(func);
+    CXFile file = nullptr;
+    const unsigned begin = offset_of(clang_getRangeStart(extent), &file);
+    const unsigned end = offset_of(clang_getRangeEnd(extent));
+    bool res = false;
+    for (unsigned i = 0; i < clang_getNumDiagnostics(tu) && !res; ++i) {
+        const CXDiagnostic diag = clang_getDiagnostic(tu, i);
+        CXFile diag_file = nullptr;
+        const unsigned offset =
+            offset_of(clang_getDiagnosticLocation(diag), &diag_file);
+        const auto severity = clang_getDiagnosticSeverity(diag);
+        res = severity == CXDiagnostic_Fatal ||
+              (severity == CXDiagnostic_Error && diag_file == file &&
+               offset >= begin && offset <= end);
+        clang_disposeDiagnostic(diag);
+    }
+    return res;
+}
+
+// the source of the definition names what the AST accounts for, and no
+// macro of its file
+void uses_no_macros(Walk &w)
+{
+    const CXTranslationUnit tu = clang_Cursor_getTranslationUnit(w.func);
+    CXToken *tokens = nullptr;
+    unsigned n = 0;
+    clang_tokenize(tu, clang_getCursorExtent(w.func), &tokens, &n);
+    for (unsigned i = 0; i < n && w.res.pure; ++i) {
+        if (clang_getTokenKind(tokens[i]) != CXToken_Identifier) {
+            continue;
+        }
+        const auto name = spelling(clang_getTokenSpelling(tu, tokens[i]));
+        if (w.names.count(name) == 0 && PURE_LIBC.count(name) == 0) {
+            impure(w, "uses " + name + ", a macro or name of its file");
+        }
+    }
+    clang_disposeTokens(tu, tokens, n);
+}
+
+}  // namespace
+
+Purity analyze_purity(CXCursor func)
+{
+    Walk w{func, {}, {}};
+    if (has_errors(func)) {
+        w.res.reason = "has errors";
+        return w.res;
+    }
+    w.res.pure = true;
+    if (!is_builtin(clang_getCursorResultType(func))) {
+        impure(w, "returns a type of its file");
+    }
+    else {
+        w.names.insert(spelling(clang_getCursorSpelling(func)));
+        clang_visitChildren(func, purity_visitor, &w);
+    }
+    if (w.res.pure) {
+        uses_no_macros(w);
+    }
+    if (!w.res.pure) {
+        w.res.callees.clear();
+    }
+    return w.res;
+}
+
+bool has_annotation(CXCursor func, const std::string &annotation)
+{
+    struct Find
+    {
+        const std::string &annotation;
+        bool found;
+    } find{annotation, false};
+    // the annotation may be on the declaration in a header only
+    for (const CXCursor decl : {func, clang_getCanonicalCursor(func)}) {
+        clang_visitChildren(
+            decl,
+            [](CXCursor child, CXCursor, CXClientData data) {
+                auto &f = *static_cast<Find *>(data);
+                if (clang_getCursorKind(child) == CXCursor_AnnotateAttr &&
+                    spelling(clang_getCursorSpelling(child)) == f.annotation) {
+                    f.found = true;
+                    return CXChildVisit_Break;
+                }
+                return CXChildVisit_Continue;
+            },
+            &find);
+    }
+    return find.found;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <clang-c/Index.h>
+#include <string>
+#include <vector>
+
+// annotation keeping an insecure entry func an ocall although it's pure:
+// __attribute__((annotate("dtee_keep_ocall")))
+#define KEEP_OCALL_ANNOTATION "dtee_keep_ocall"
+
+// whether the body of a function can run in the other world as it is
+struct Purity {
+  // touches nothing but its parameters and locals, and calls nothing but
+  // the callees below and side effect free libc math
+  bool pure = false;
+  // what made it impure, for the log
+  std::string reason;
+  // the funcs it calls, which have to be pure too
+  std::vector<std::string> callees;
+};
+
+/// @brief find whether the function definition func is pure: no global or
+/// static variable is referenced, nothing is allocated, thrown or done in
+/// assembly, and only plain functions (no methods or constructors) are
+/// called. Calls through pointers and unresolved calls make it impure. Its
+/// source has to stand on its own, so it may only name builtin types and
+/// no macros, enumerators or other declarations of its file.
+Purity analyze_purity(CXCursor func);
+
+/// @brief the definition or a declaration of func carries the annotation
+bool has_annotation(CXCursor func, const std::string &annotation);
@@ -0,0 +1,331 @@
+#include "reachability.h"
+
+#include <deque>
+
+#include "clang-c/CXString.h"
+#include "clang-c/Index.h"
+#include "libclang.h"
+#include "parser.h"
+#include "pch.h"
+
+namespace {
+
+struct Collect
+{
+    CXTranslationUnit tu = nullptr;
+    std::unordered_set<std::string> defines;
+    std::unordered_set<std::string> references;
+    bool has_static_init = false;
+};
+
+// parse_file hands the visitor the file context, the symbols go here
+thread_local Collect *tls_collect = nullptr;
+
+std::string spelling(CXString str)
+{
+    std::string res = clang_getCString(str);
+    clang_disposeString(str);
+    return res;
+}
+
+bool is_class(CXCursorKind kind)
+{
+    return kind == CXCursor_StructDecl || kind == CXCursor_UnionDecl ||
+           kind == CXCursor_ClassDecl || kind == CXCursor_ClassTemplate;
+}
+
+bool is_function(CXCursorKind kind)
+{
+    return kind == CXCursor_FunctionDecl || kind == CXCursor_CXXMethod ||
+           kind == CXCursor_Constructor || kind == CXCursor_Destructor ||
+           kind == CXCursor_ConversionFunction ||
+           kind == CXCursor_FunctionTemplate;
+}
+
+bool has_errors(CXTranslationUnit tu)
+{
+    for (unsigned i = 0; i < clang_getNumDiagnostics(tu); ++i) {
+        const CXDiagnostic diag = clang_getDiagnostic(tu, i);
+        const auto severity = clang_getDiagnosticSeverity(diag);
+        clang_disposeDiagnostic(diag);
+        if (severity >= CXDiagnostic_Error) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a class is used, so are its out of line members and those of its bases
+void reference_class(Collect &c, CXCursor cls)
+{
+    if (!c.references.insert(spelling(clang_getCursorSpelling(cls)) + "::")
+             .second) {
+        return;
+    }
+    const CXCursor def = clang_getCursorDefinition(cls);
+    if (clang_Cursor_isNull(def)) {
+        return;
+    }
+    clang_visitChildren(
+        def,
+        [](CXCursor child, CXCursor, CXClientData data) {
+            if (clang_getCursorKind(child) == CXCursor_CXXBaseSpecifier) {
+                const CXCursor base =
+                    clang_getTypeDeclaration(clang_getCursorType(child));
+                if (is_class(clang_getCursorKind(base))) {
+                    reference_class(*static_cast<Collect *>(data), base);
+                }
+            }
+            return CXChildVisit_Continue;
+        },
+        &c);
+}
+
+void reference(Collect &c, CXCursor cursor)
+{
+    const CXCursor ref = clang_getCursorReferenced(cursor);
+    const auto kind = clang_getCursorKind(ref);
+    if (clang_Cursor_isNull(ref) ||
+        clang_getCursorKind(cursor) == CXCursor_OverloadedDeclRef) {
+        // unresolved, e.g. a dependent call in a template, go by the name
+        const auto name = spelling(clang_getCursorSpelling(cursor));
+        if (!name.empty()) {
+            c.references.insert(name);
+        }
+        return;
+    }
+    if (is_class(kind)) {
+        reference_class(c, ref);
+        return;
+    }
+    if ((!is_function(kind) && kind != CXCursor_VarDecl) ||
+        clang_getCursorLinkage(ref) != CXLinkage_External) {
+        return;
+    }
+    const CXCursor scope = clang_getCursorSemanticParent(ref);
+    if (is_class(clang_getCursorKind(scope))) {
+        reference_class(c, scope);
+    }
+    else {
+        c.references.insert(spelling(clang_getCursorSpelling(ref)));
+    }
+}
+
+// the initializer of a global calls something (a constructor included)
+bool has_call(CXCursor var)
+{
+    bool res = false;
+    clang_visitChildren(
+        var,
+        [](CXCursor child, CXCursor, CXClientData data) {
+            const auto kind = clang_getCursorKind(child);
+            if (kind == CXCursor_CallExpr ||
+                kind == CXCursor_OverloadedDeclRef) {
+                *static_cast<bool *>(data) = true;
+                return CXChildVisit_Break;
+            }
+            return CXChildVisit_Recurse;
+        },
+        &res);
+    return res;
+}
+
+bool is_constructor_attr(CXTranslationUnit tu, CXCursor attr)
+{
+    CXToken *tokens = nullptr;
+    unsigned n = 0;
+    clang_tokenize(tu, clang_getCursorExtent(attr), &tokens, &n);
+    bool res = false;
+    for (unsigned i = 0; i < n && !res; ++i) {
+        const auto s = spelling(clang_getTokenSpelling(tu, tokens[i]));
+        res = s == "constructor" || s == "__constructor__";
+    }
+    clang_disposeTokens(tu, tokens, n);
+    return res;
+}
+
+CXChildVisitResult symbol_collect_visitor(CXCursor cursor, CXCursor parent,
+                                          CXClientData)
+{
+    auto &c = *tls_collect;
+    const CXSourceLocation loc = clang_getCursorLocation(cursor);
+    if (clang_Location_isInSystemHeader(loc)) {
+        return CXChildVisit_Continue;
+    }
+    if (c.tu == nullptr) {
+        c.tu = clang_Cursor_getTranslationUnit(cursor);
+    }
+    const auto kind = clang_getCursorKind(cursor);
+    const bool in_main_file = clang_Location_isFromMainFile(loc);
+
+    if (in_main_file && (is_function(kind) || kind == CXCursor_VarDecl) &&
+        clang_isCursorDefinition(cursor) &&
+        clang_getCursorLinkage(cursor) == CXLinkage_External) {
+        const CXCursor scope = clang_getCursorSemanticParent(cursor);
+        if (is_class(clang_getCursorKind(scope))) {
+            c.defines.insert(spelling(clang_getCursorSpelling(scope)) + "::");
+        }
+        c.defines.insert(spelling(clang_getCursorSpelling(cursor)));
+    }
+
+    if (in_main_file && kind == CXCursor_VarDecl &&
+        clang_isCursorDefinition(cursor) &&
+        clang_getCursorLinkage(cursor) != CXLinkage_NoLinkage) {
+        // a global of a type clang couldn't resolve may have a constructor
+        c.has_static_init |=
+            clang_isInvalidDeclaration(cursor) || has_call(cursor);
+    }
+    if (in_main_file && kind == CXCursor_UnexposedAttr &&
+        is_function(clang_getCursorKind(parent))) {
+        c.has_static_init |= is_constructor_attr(c.tu, cursor);
+    }
+
+    switch (kind) {
+    case CXCursor_TypeRef:
+    case CXCursor_TemplateRef:
+    case CXCursor_MemberRef:
+    case CXCursor_OverloadedDeclRef:
+    case CXCursor_DeclRefExpr:
+    case CXCursor_MemberRefExpr:
+    case CXCursor_CallExpr:
+        reference(c, cursor);
+        break;
+    default:
+        break;
+    }
+    return CXChildVisit_Recurse;
+}
+
+// the AST of a file with errors misses whatever clang couldn't resolve, fall
+// back to its tokens: every identifier may be a reference, and every name
+// followed by ( or :: outside of code blocks may be defined here
+void collect_tokens(Collect &c)
+{
+    CXToken *tokens = nullptr;
+    unsigned n = 0;
+    clang_tokenize(c.tu,
+                   clang_getCursorExtent(clang_getTranslationUnitCursor(c.tu)),
+                   &tokens, &n);
+    std::vector<std::string> s(n);
+    for (unsigned i = 0; i < n; ++i) {
+        s[i] = spelling(clang_getTokenSpelling(c.tu, tokens[i]));
+    }
+
+    // braces of namespaces and extern "C" blocks don't open code blocks
+    std::vector<bool> code_block;
+    size_t depth = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        const auto kind = clang_getTokenKind(tokens[i]);
+        if (kind == CXToken_Identifier) {
+            c.references.insert(s[i]);
+            c.references.insert(s[i] + "::");
+            if (depth == 0 && i + 1 < n &&
+                (s[i + 1] == "(" || s[i + 1] == "::")) {
+                c.defines.insert(s[i + 1] == "(" ? s[i] : s[i] + "::");
+            }
+        }
+        else if (kind == CXToken_Punctuation && s[i] == "{") {
+            unsigned j = i;
+            while (j > 0 && (clang_getTokenKind(tokens[j - 1]) ==
+                                 CXToken_Identifier ||
+                             s[j - 1] == "::")) {
+                --j;
+            }
+            const bool scope =
+                (j > 0 && s[j - 1] == "namespace") ||
+                (i > 1 && s[i - 2] == "extern" &&
+                 clang_getTokenKind(tokens[i - 1]) == CXToken_Literal);
+            code_block.push_back(!scope);
+            depth += !scope;
+        }
+        else if (kind == CXToken_Punctuation && s[i] == "}" &&
+                 !code_block.empty()) {
+            depth -= code_block.back();
+            code_block.pop_back();
+        }
+    }
+    clang_disposeTokens(c.tu, tokens, n);
+}
+
+}  // namespace
+
+bool collect_symbols(const std::string &file, TuSymbols &symbols)
+{
+    Collect c;
+    tls_collect = &c;
+    FileContext f_ctx{.file_path = file};
+    const bool parsed = parse_file(f_ctx, symbol_collect_visitor);
+    tls_collect = nullptr;
+    if (!parsed) {
+        return false;
+    }
+    if (c.tu != nullptr && has_errors(c.tu)) {
+        DTEE_LOG_DEBUG("%s has errors, collecting its symbols from tokens\n",
+                       file.c_str());
+        collect_tokens(c);
+    }
+
+    symbols.defines.assign(c.defines.begin(), c.defines.end());
+    symbols.references.assign(c.references.begin(), c.references.end());
+    symbols.has_static_init = c.has_static_init;
+    return true;
+}
+
+std::vector<std::string> find_unreachable_units(
+    const std::vector<std::string> &units,
+    const std::unordered_map<std::string, TuSymbols> &symbols,
+    const std::unordered_set<std::string> &roots)
+{
+    // name -> units defining it
+    std::unordered_map<std::string, std::vector<const std::string *>> definers;
+    for (const auto &unit : units) {
+        const auto it = symbols.find(unit);
+        if (it == symbols.end()) {
+            continue;
+        }
+        for (const auto &name : it->second.defines) {
+            definers[name].push_back(&unit);
+        }
+    }
+
+    std::unordered_set<std::string> reached;
+    std::deque<const std::string *> queue;
+    const auto reach = [&](const std::string &unit) {
+        if (reached.insert(unit).second) {
+            queue.push_back(&unit);
+        }
+    };
+    for (const auto &unit : units) {
+        const auto it = symbols.find(unit);
+        if (roots.count(unit) != 0 || it == symbols.end() ||
+            it->second.has_static_init) {
+            reach(unit);
+        }
+    }
+    while (!queue.empty()) {
+        const auto &unit = *queue.front();
+        queue.pop_front();
+        const auto it = symbols.find(unit);
+        if (it == symbols.end()) {
+            continue;
+        }
+        for (const auto &name : it->second.references) {
+            const auto d = definers.find(name);
+            if (d == definers.end()) {
+                continue;
+            }
+            for (const auto *definer : d->second) {
+                reach(*definer);
+            }
+        }
+    }
+
+    std::vector<std::string> res;
+    for (const auto &unit : units) {
+        if (reached.count(unit) == 0) {
+            DTEE_LOG_DEBUG("UNREACHABLE: %s\n", unit.c_str());
+            res.push_back(unit);
+        }
+    }
+    return res;
+}
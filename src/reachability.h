@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// the names a translation unit defines and references. Names are plain
+// spellings, "Class::" stands for the members of a class, so a unit using a
+// class reaches the units defining its out of line members.
+struct TuSymbols {
+  std::vector<std::string> defines;
+  std::vector<std::string> references;
+  // runs code before main (globals with constructors, constructor
+  // attributes), it has to be linked in whether referenced or not
+  bool has_static_init = false;
+};
+
+/// @brief collect the symbols of a source file, false if libclang could not
+/// parse it.
+///
+/// Only what the file itself defines counts, inline code in headers is
+/// compiled into each unit using it. Where libclang couldn't make sense of
+/// the file (e.g. a header wasn't found) the AST misses names, so every
+/// identifier of the file counts as referenced and every name declared at
+/// file scope as defined.
+bool collect_symbols(const std::string &file, TuSymbols &symbols);
+
+/// @brief units (a subset of units) no root reaches through the names they
+/// reference. Units with static initializers or without symbols are roots
+/// too.
+///
+/// Names are matched without scopes or signatures, two functions of the
+/// same name in different namespaces are one, which only keeps more units.
+std::vector<std::string> find_unreachable_units(
+    const std::vector<std::string> &units,
+    const std::unordered_map<std::string, TuSymbols> &symbols,
+    const std::unordered_set<std::string> &roots);
@@ -12,8 +12,18 @@ std::unordered_map<std::string, decltype(&SourceContext::project)> replaces{
     PATTERN(params),      PATTERN(comma_params),
     PATTERN(func_name),   PATTERN(comma_param_names),
     PATTERN(root_cmake),  PATTERN(host_secure_cmake),
-    PATTERN(project),     PATTERN(edl_params),
-    PATTERN(src_path)};
+    PATTERN(project),     PATTERN(func_id),
+    PATTERN(src_path),    PATTERN(enclave_sources),
+    PATTERN(enclave_include_dirs), PATTERN(minimal_include_dirs),
+    PATTERN(enclave_unity_sources), PATTERN(enclave_pch_headers),
+    PATTERN(host_unity_batch_size), PATTERN(host_pch_headers),
+    PATTERN(marshal_desc), PATTERN(marshal_args),
+    PATTERN(invoke_args), PATTERN(build_profile),
+    PATTERN(relocated_defs), PATTERN(type_includes),
+    PATTERN(assets_size), PATTERN(assets_hash),
+    PATTERN(embed_asm), PATTERN(embed_decls),
+    PATTERN(enclave_stdio), PATTERN(enclave_threads),
+    PATTERN(enclave_tcs), PATTERN(shared_region)};
 
 std::string parse_template(const std::string &templ, const SourceContext &ctx) {
   std::stringstream ss;
@@ -44,7 +54,7 @@ std::string parse_template(const std::string &templ, const SourceContext &ctx) {
   return ss.str();
 }
 
-template <bool WithType, bool IsEDL, bool WithCommaAhead>
+template <bool WithType, bool WithCommaAhead>
 std::string get_params_str(const std::vector<Param> &params) {
   std::stringstream ss;
   bool flag = false;
@@ -58,26 +68,6 @@ std::string get_params_str(const std::vector<Param> &params) {
     } else {
       ss << ", ";
     }
-    if constexpr (IsEDL) {
-      if (param.is_array || param.is_ptr) {
-        ss << "[";
-        if (param.is_in && !param.is_out) {
-          ss << "in";
-        } else if (!param.is_in && param.is_out) {
-          ss << "out";
-        } else {
-          ss << "in, out";
-        }
-        ss << ", size=";
-        if (param.is_ptr) {
-          ss << param.name << "_len";
-        } else {
-          ASSERT(param.array_size >= 0, "param size < 0");
-          ss << param.array_size;
-        }
-        ss << "] ";
-      }
-    }
     if constexpr (WithType) {
       ss << param.type << " " << param.name;
     } else {
@@ -91,22 +81,101 @@ std::string get_params_str(const std::vector<Param> &params) {
 }
 
 std::string get_params(const std::vector<Param> &params) {
-  return get_params_str<true, false, false>(params);
+  return get_params_str<true, false>(params);
 }
 
 std::string get_comma_params(const std::vector<Param> &params) {
-  return get_params_str<true, false, true>(params);
+  return get_params_str<true, true>(params);
 }
 
 std::string get_comma_param_names(const std::vector<Param> &params) {
-  return get_params_str<false, false, true>(params);
+  return get_params_str<false, true>(params);
+}
+
+uint32_t get_func_id(const std::string &func_name) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (const unsigned char c : func_name) {
+    h = (h ^ c) * 16777619u;
+  }
+  return h;
 }
 
-std::string get_edl_params(const std::vector<Param> &params) {
-  return get_params_str<true, true, false>(params);
+// Z_MAX_PARAMS in z_marshal.h
+constexpr size_t MAX_MARSHALLED_PARAMS = 64;
+
+// the element type of a buffer param, whose type is spelled T*
+std::string get_element_type(const Param &param) {
+  return param.type.substr(0, param.type.size() - 1);
 }
 
-std::string get_filepath(std::ifstream &ifs, const SourceContext &ctx) {
+// flat descriptor of an entry func, laid out as described in z_marshal.h
+std::string get_marshal_desc(const std::string &func_name,
+                             const std::string &ret,
+                             const std::vector<Param> &params) {
+  ASSERT(params.size() <= MAX_MARSHALLED_PARAMS,
+         "%s has %zu params, at most %zu can cross the boundary",
+         func_name.c_str(), params.size(), MAX_MARSHALLED_PARAMS);
+  std::stringstream ss;
+  ss << "sizeof(" << ret << "), " << params.size();
+  for (const auto &param : params) {
+    if (!param.is_ptr && !param.is_array) {
+      ss << ", 0, sizeof(" << param.type << "), 1";
+      continue;
+    }
+    // Z_BUF | Z_IN | Z_OUT | Z_SHARED, a buffer with neither direction is
+    // copied both ways
+    const bool in = param.is_in || !param.is_out;
+    const bool out = param.is_out || !param.is_in;
+    ss << ", "
+       << (4 | (in ? 1 : 0) | (out ? 2 : 0) | (param.is_shared ? 8 : 0));
+    // pointers sized by _len count bytes, the rest elements
+    if (param.is_ptr && !param.is_count) {
+      ss << ", 1";
+    } else {
+      ss << ", sizeof(" << get_element_type(param) << ")";
+    }
+    // pointers are followed by their count
+    ss << ", " << (param.is_array ? param.array_size : 0);
+  }
+  return ss.str();
+}
+
+// what the caller passes for each param: the address of values and the
+// buffers themselves
+std::string get_marshal_args(const std::vector<Param> &params) {
+  if (params.empty()) {
+    return "0";
+  }
+  std::stringstream ss;
+  for (size_t i = 0; i < params.size(); ++i) {
+    const auto &param = params[i];
+    ss << (i == 0 ? "" : ", ");
+    if (param.is_ptr || param.is_array) {
+      ss << "(void *)" << param.name;
+    } else {
+      ss << "&" << param.name;
+    }
+  }
+  return ss.str();
+}
+
+// the params of the callee from what the dispatcher unmarshalled
+std::string get_invoke_args(const std::vector<Param> &params) {
+  std::stringstream ss;
+  for (size_t i = 0; i < params.size(); ++i) {
+    const auto &param = params[i];
+    ss << (i == 0 ? "" : ", ");
+    if (param.is_ptr || param.is_array) {
+      ss << "(" << param.type << ")args[" << i << "]";
+    } else {
+      ss << "*(" << param.type << " *)args[" << i << "]";
+    }
+  }
+  return ss.str();
+}
+
+std::string get_filepath(std::istream &ifs, const SourceContext &ctx) {
   assert(ifs);
   std::string label, filepath;
   ifs >> label;
@@ -150,7 +219,7 @@ LineType get_line_type(const std::string &line) {
   /* } */
 }
 
-std::string get_content(std::ifstream &ifs, const SourceContext &ctx) {
+std::string get_content(std::istream &ifs, const SourceContext &ctx) {
   assert(ifs);
   std::string line;
   std::stringstream ss;
@@ -231,8 +300,12 @@ std::string get_content(std::ifstream &ifs, const SourceContext &ctx) {
         each_ctx.params = get_params(func.parameters);
         each_ctx.comma_params = get_comma_params(func.parameters);
         each_ctx.comma_param_names = get_comma_param_names(func.parameters);
-        each_ctx.edl_params = get_edl_params(func.parameters);
         each_ctx.ret = func.returnType;
+        each_ctx.func_id = std::to_string(get_func_id(func.name));
+        each_ctx.marshal_desc =
+            get_marshal_desc(func.name, func.returnType, func.parameters);
+        each_ctx.marshal_args = get_marshal_args(func.parameters);
+        each_ctx.invoke_args = get_invoke_args(func.parameters);
 
         for (const auto &line : lines) {
           ss << parse_template(line, each_ctx) << std::endl;
@@ -255,17 +328,34 @@ std::string get_content(std::ifstream &ifs, const SourceContext &ctx) {
   return ss.str();
 }
 
+// templates are read once per process, they are rendered for every source
+// file of every project converted
+const std::string &template_text(const std::filesystem::path &template_path) {
+  static std::shared_mutex mutex;
+  static std::unordered_map<std::string, std::string> cache;
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    const auto it = cache.find(template_path.string());
+    if (it != cache.end()) {
+      return it->second;
+    }
+  }
+  auto text = read_file_content(template_path);
+  std::scoped_lock<std::shared_mutex> lock(mutex);
+  return cache.emplace(template_path.string(), std::move(text)).first->second;
+}
+
 void generate_with_template(const std::filesystem::path &template_path,
                             const SourceContext &ctx,
                             const std::filesystem::path &target_path) {
   ctx.show();
-  std::ifstream ifs(template_path);
+  std::istringstream ifs(template_text(template_path));
   const auto filepath = get_filepath(ifs, ctx);
   const auto content = get_content(ifs, ctx);
 
   const auto path = target_path / filepath;
-  DTEE_LOG("GENERATED FROM TEMPLATE: %s TO FILE: %s\n", template_path.c_str(),
-           filepath.c_str());
+  DTEE_LOG_DEBUG("GENERATED FROM TEMPLATE: %s TO FILE: %s\n",
+                 template_path.c_str(), filepath.c_str());
   std::filesystem::create_directories(path.parent_path());
   std::ofstream ofs(path);
   ofs << content;
@@ -8,17 +8,59 @@ struct SourceContext {
   std::string params;
   std::string comma_params;
   std::string comma_param_names;
-  std::string edl_params;
+  // table driven marshalling of the entry func, see z_marshal.h
+  std::string func_id;
+  std::string marshal_desc;
+  std::string marshal_args;
+  std::string invoke_args;
   std::string func_name;
   std::string root_cmake;
   std::string host_secure_cmake;
   std::string src_path;
+  // pure insecure entry funcs of the file compiled into the enclave, see
+  // FunctionInfo::definition
+  std::string relocated_defs;
+  // the headers the stubs replacing a file include for the user types its
+  // entry funcs take, see Param::type_header
+  std::string type_includes;
+  // the bundle of the project's assets/, see z_assets.h
+  std::string assets_size = "0";
+  std::string assets_hash;
+  // the files of the project's embed/, see z_embed.h
+  std::string embed_asm;
+  std::string embed_decls;
+  // the enclave sources open files, fopen and the like are wrapped, see
+  // z_stdio.h
+  std::string enclave_stdio = "OFF";
+  // "1" if an entry func takes a shared_char buffer, the host maps the
+  // shared region into the enclave then, see z_shared.h
+  std::string shared_region = "0";
+  // host threads running enclave threads and the TCS slots of the enclave,
+  // see z_threads.h
+  std::string enclave_threads = "0";
+  std::string enclave_tcs = "10";
+  // explicit enclave build inputs, see enclave_template.cmake
+  std::string enclave_sources;
+  std::string enclave_include_dirs;
+  std::string minimal_include_dirs = "OFF";
+  std::string enclave_unity_sources;
+  std::string enclave_pch_headers;
+  std::string host_unity_batch_size = "0";
+  std::string host_pch_headers;
+  // Release, Debug, PGO_GENERATE or PGO_USE
+  std::string build_profile = "Release";
+  // headers declaring the user types of entry func params, relative to the
+  // tree roots
 
   void show() const {
-    DTEE_LOG("SourceContext{ src_path: %s }\n", src_path.c_str());
+    DTEE_LOG_TRACE("SourceContext{ src_path: %s }\n", src_path.c_str());
   }
 };
 
+/// @brief id an entry func is called by across the boundary, a hash of its
+/// name so it's known before all entry funcs are
+uint32_t get_func_id(const std::string &func_name);
+
 std::string parse_template(const std::string &templ, const SourceContext &ctx);
 
 /// @breif each template will generate one file
@@ -38,10 +38,29 @@ set(PEM Enclave_private.pem)
 set(SIGN_TOOL ${LOCAL_ROOT_PATH}/tools/sign_tool/sign_tool.sh)
 message("LOCAL_ROOT_PATH is ${LOCAL_ROOT_PATH}")
 
-file(GLOB_RECURSE SOURCE_FILES 
-"${CMAKE_CURRENT_SOURCE_DIR}/insecure/*.c" "${CMAKE_CURRENT_SOURCE_DIR}/insecure/*.cpp" "${CMAKE_CURRENT_SOURCE_DIR}/insecure/*.cc" 
-"${CMAKE_CURRENT_SOURCE_DIR}/secure/*.c" "${CMAKE_CURRENT_SOURCE_DIR}/secure/*.cpp" "${CMAKE_CURRENT_SOURCE_DIR}/secure/*.cc"
-)
+# enclave sources and the include directories they need, as computed by
+# dteegen from the include graph. Glob and add every directory otherwise.
+set(ENCLAVE_SOURCE_FILES${enclave_sources})
+set(ENCLAVE_INCLUDE_DIRS${enclave_include_dirs})
+set(ENCLAVE_MINIMAL_INCLUDE_DIRS ${minimal_include_dirs})
+
+if(ENCLAVE_SOURCE_FILES)
+  set(SOURCE_FILES ${ENCLAVE_SOURCE_FILES})
+else()
+  file(GLOB_RECURSE SOURCE_FILES 
+  "${CMAKE_CURRENT_SOURCE_DIR}/insecure/*.c" "${CMAKE_CURRENT_SOURCE_DIR}/insecure/*.cpp" "${CMAKE_CURRENT_SOURCE_DIR}/insecure/*.cc" 
+  "${CMAKE_CURRENT_SOURCE_DIR}/secure/*.c" "${CMAKE_CURRENT_SOURCE_DIR}/secure/*.cpp" "${CMAKE_CURRENT_SOURCE_DIR}/secure/*.cc"
+  )
+endif()
+
+# optional unity sources (dteegen --unity), each including several of the
+# sources, and headers to precompile (dteegen --pch)
+set(ENCLAVE_UNITY_SOURCES${enclave_unity_sources})
+set(ENCLAVE_PCH_HEADERS${enclave_pch_headers})
+set(SOURCE_DEPENDS ${SOURCE_FILES})
+if(ENCLAVE_UNITY_SOURCES)
+  set(SOURCE_FILES ${ENCLAVE_UNITY_SOURCES})
+endif()
 #set enclave src code
 #set(SOURCE_FILES ${CMAKE_CURRENT_SOURCE_DIR}/*.c)
 
@@ -60,11 +79,44 @@ function(add_include_directories_recursively root_dir)
     endif()
 endfunction()
 
-add_include_directories_recursively("${CMAKE_CURRENT_SOURCE_DIR}/insecure")
-add_include_directories_recursively("${CMAKE_CURRENT_SOURCE_DIR}/secure")
+if(ENCLAVE_MINIMAL_INCLUDE_DIRS)
+  set(INC_DIRS ${ENCLAVE_INCLUDE_DIRS})
+else()
+  add_include_directories_recursively("${CMAKE_CURRENT_SOURCE_DIR}/insecure")
+  add_include_directories_recursively("${CMAKE_CURRENT_SOURCE_DIR}/secure")
+endif()
 foreach(dir ${INCLUDE_DIRS})
   list(APPEND INC_DIRS ${dir})
 endforeach()
+# z_state.h, the enclave state API
+list(APPEND INC_DIRS ${CURRENT_ROOT_PATH})
+
+# embed.S links the files of embed/ in, the assembler looks for them here
+set(EMBED_FILE ${CMAKE_CURRENT_SOURCE_DIR}/embed.S)
+file(GLOB_RECURSE EMBEDDED_FILES ${CMAKE_CURRENT_SOURCE_DIR}/embed/*)
+set(EMBED_FLAGS -Wa,-I${CMAKE_CURRENT_SOURCE_DIR})
+if(NOT CC_PL)
+  enable_language(ASM)
+  set_source_files_properties(${EMBED_FILE} PROPERTIES
+    COMPILE_OPTIONS "${EMBED_FLAGS}" OBJECT_DEPENDS "${EMBEDDED_FILES}")
+endif()
+
+# the enclave sources read files through z_stdio.cpp instead of the libc,
+# see z_stdio.h
+set(ENCLAVE_STDIO ${enclave_stdio})
+set(ENCLAVE_WRAP_LINK_FLAGS "")
+if(ENCLAVE_STDIO)
+  foreach(FUNC fopen fclose fread fwrite fseek fseeko ftell ftello rewind feof ferror clearerr fgetc getc fgets)
+    list(APPEND ENCLAVE_WRAP_LINK_FLAGS -Wl,--wrap=${FUNC})
+  endforeach()
+endif()
+# the threads the enclave creates run on host threads, see z_threads.h
+set(ENCLAVE_THREADS ${enclave_threads})
+if(ENCLAVE_THREADS GREATER 0)
+  foreach(FUNC pthread_create pthread_join pthread_detach)
+    list(APPEND ENCLAVE_WRAP_LINK_FLAGS -Wl,--wrap=${FUNC})
+  endforeach()
+endif()
 
 set(COMPILER_INCLUDES "")
 foreach(dir ${INC_DIRS})
@@ -114,10 +166,45 @@ if(CC_PL)
     COMMAND ${CODEGEN} --${CODETYPE} --trusted ${CURRENT_ROOT_PATH}/${EDL_FILE} --search-path ${LOCAL_ROOT_PATH}/inc/host_inc/penglai)
 endif()
 
+# Release and Debug apply to every enclave type, the PGO profiles are built
+# as Release outside of Penglai:
+#   PGO_GENERATE  instrumented, run the host with DTEE_PROFILE_OUT=<file> and
+#                 the enclave appends its counters to <file> whenever it's
+#                 destroyed. `gcov-tool merge-stream <file>` (gcc 13) turns
+#                 them into .gcda files next to the enclave objects
+#   PGO_USE       rebuilt in the same build directory with the .gcda files
+#                 and LTO
+set(ENCLAVE_BUILD_PROFILE ${build_profile} CACHE STRING "Release, Debug, PGO_GENERATE or PGO_USE")
+set_property(CACHE ENCLAVE_BUILD_PROFILE PROPERTY STRINGS Release Debug PGO_GENERATE PGO_USE)
+set(ENCLAVE_PGO_FLAGS "")
+set(ENCLAVE_LTO OFF)
+if(ENCLAVE_BUILD_PROFILE STREQUAL "Debug")
+  set(ENCLAVE_OPT_FLAGS -O0 -g -fno-peephole -fno-peephole2)
+elseif(ENCLAVE_BUILD_PROFILE STREQUAL "Release")
+  set(ENCLAVE_OPT_FLAGS -O2)
+elseif(ENCLAVE_BUILD_PROFILE STREQUAL "PGO_GENERATE")
+  set(ENCLAVE_OPT_FLAGS -O2)
+  # the counters go to the .gcov_info section instead of files at exit,
+  # z_dispatch.cpp streams them out
+  set(ENCLAVE_PGO_FLAGS -fprofile-generate -fprofile-update=atomic -fprofile-info-section -DDTEE_PROFILE_GENERATE)
+elseif(ENCLAVE_BUILD_PROFILE STREQUAL "PGO_USE")
+  set(ENCLAVE_OPT_FLAGS -O2)
+  set(ENCLAVE_PGO_FLAGS -fprofile-use -fprofile-partial-training -Wno-missing-profile -flto=auto)
+  set(ENCLAVE_LTO ON)
+else()
+  message(FATAL_ERROR "Unknown ENCLAVE_BUILD_PROFILE ${ENCLAVE_BUILD_PROFILE}")
+endif()
+if(ENCLAVE_PGO_FLAGS AND NOT CC_PL)
+  message(WARNING "${ENCLAVE_BUILD_PROFILE} is only supported for Penglai enclaves, building as Release")
+endif()
+message("ENCLAVE_BUILD_PROFILE is ${ENCLAVE_BUILD_PROFILE}")
+string(REPLACE ";" " " ENCLAVE_OPT_FLAGS_STRING "${ENCLAVE_OPT_FLAGS}")
+
 set(COMMON_C_FLAGS "-W -Wall -Werror  -fno-short-enums  -fno-omit-frame-pointer -fstack-protector \
  -Wstack-protector --param ssp-buffer-size=4 -frecord-gcc-switches -Wextra -nostdinc -nodefaultlibs \
- -fno-peephole -fno-peephole2 -Wno-main -Wno-error=unused-parameter \
-        -Wno-error=unused-but-set-variable -Wno-error=format-truncation=")
+ -Wno-main -Wno-error=unused-parameter \
+        -Wno-error=unused-but-set-variable -Wno-error=format-truncation= \
+ -ffunction-sections -fdata-sections ${ENCLAVE_OPT_FLAGS_STRING}")
 
 set(COMMON_C_LINK_FLAGS "-Wl,-z,now -Wl,-z,relro -Wl,-z,noexecstack -Wl,-nostdlib -nodefaultlibs -nostartfiles")
 
@@ -125,7 +212,7 @@ if(CC_GP)
 
   set(CMAKE_C_FLAGS "${COMMON_C_FLAGS}  -march=armv8-a ")
   set(CMAKE_C_FLAGS_RELEASE "${CMAKE_C_FLAGS}  -s -fPIC")
-  set(CMAKE_SHARED_LINKER_FLAGS  "${COMMON_C_LINK_FLAGS} -Wl,-s")
+  set(CMAKE_SHARED_LINKER_FLAGS  "${COMMON_C_LINK_FLAGS} -Wl,-s -Wl,--gc-sections")
 
   set(ITRUSTEE_TEEDIR ${iTrusteeSDK}/)
   set(ITRUSTEE_LIBC ${iTrusteeSDK}/thirdparty/open_source/musl/libc)
@@ -134,7 +221,7 @@ if(CC_GP)
     link_directories(${CMAKE_BINARY_DIR}/lib/)
   endif()
 
-  add_library(${PREFIX} SHARED ${SOURCE_FILES} ${AUTO_FILES})
+  add_library(${PREFIX} SHARED ${SOURCE_FILES} ${AUTO_FILES} ${EMBED_FILE})
 
   target_include_directories( ${PREFIX} PRIVATE
  ${CMAKE_CURRENT_BINARY_DIR}
@@ -198,7 +285,7 @@ if(CC_SGX)
     link_directories(${LINK_LIBRARY_PATH})
   endif()
 
-  add_library(${PREFIX}  SHARED ${SOURCE_FILES} ${AUTO_FILES})
+  add_library(${PREFIX}  SHARED ${SOURCE_FILES} ${AUTO_FILES} ${EMBED_FILE})
 
   target_include_directories(${PREFIX} PRIVATE
      ${CMAKE_CURRENT_BINARY_DIR}
@@ -224,6 +311,10 @@ endif()
 
 if(NOT DEFINED CC_PL)
   set_target_properties(${PREFIX} PROPERTIES SKIP_BUILD_RPATH TRUE)
+  target_link_libraries(${PREFIX} ${ENCLAVE_WRAP_LINK_FLAGS})
+  if(ENCLAVE_PCH_HEADERS)
+    target_precompile_headers(${PREFIX} PRIVATE ${ENCLAVE_PCH_HEADERS})
+  endif()
 endif()
 
 if(CC_PL)
@@ -240,20 +331,68 @@ if(CC_PL)
   set(CC riscv64-linux-gnu-gcc)
   set(CXX riscv64-linux-gnu-g++)
   set(LD riscv64-linux-gnu-ld)
+  set(SIZE riscv64-linux-gnu-size)
   set(GCC_LIB ${SDK_LIB_DIR}/libgcc.a)
   set(SECGEAR_TEE_LIB ${CMAKE_BINARY_DIR}/lib/libsecgear_tee.a)
 
   set(SOURCE_C_OBJS "")
+  # one section per function and object, so the link drops what nothing
+  # references
+  set(ENCLAVE_SECTION_FLAGS -ffunction-sections -fdata-sections)
+  # where the enclave sees the untrusted memory of the host, the shared
+  # region of z_shared.h (DEFAULT_UNTRUSTED_PTR of the Penglai SDK)
+  set(ENCLAVE_SHARED_BASE 0x0000001000000000 CACHE STRING "Address of the untrusted memory in Penglai enclaves")
+  # the most of it the enclave takes as the shared region, whatever size the
+  # host claims, so the region stays clear of the enclave's own memory
+  set(ENCLAVE_SHARED_SIZE 0x40000000 CACHE STRING "Largest shared region a Penglai enclave accepts")
+  set(ENCLAVE_CODEGEN_FLAGS ${ENCLAVE_SECTION_FLAGS} ${ENCLAVE_OPT_FLAGS} ${ENCLAVE_PGO_FLAGS} -DZ_SHARED_ENCLAVE_BASE=${ENCLAVE_SHARED_BASE} -DZ_SHARED_ENCLAVE_SIZE=${ENCLAVE_SHARED_SIZE})
+  if(ENCLAVE_LTO)
+    # the driver runs the LTO plugin, the rest of the link is spelled out
+    set(ENCLAVE_LD ${CXX} -nostdlib -nostartfiles ${ENCLAVE_OPT_FLAGS} ${ENCLAVE_PGO_FLAGS} -Wl,--gc-sections)
+  else()
+    set(ENCLAVE_LD ${LD} --gc-sections)
+    list(TRANSFORM ENCLAVE_WRAP_LINK_FLAGS REPLACE "^-Wl," "")
+  endif()
+  set(ENCLAVE_GCOV_LIB "")
+  if(ENCLAVE_BUILD_PROFILE STREQUAL "PGO_GENERATE")
+    execute_process(COMMAND ${CXX} -print-file-name=libgcov.a
+      OUTPUT_VARIABLE ENCLAVE_GCOV_LIB OUTPUT_STRIP_TRAILING_WHITESPACE)
+  endif()
+
+  # target_precompile_headers doesn't apply to custom commands, do what it
+  # does: gcc uses enclave_pch.h.gch when it's valid for -include enclave_pch.h
+  set(ENCLAVE_PCH_FLAGS "")
+  set(ENCLAVE_PCH_GCH "")
+  if(ENCLAVE_PCH_HEADERS)
+    set(ENCLAVE_PCH ${CMAKE_CURRENT_BINARY_DIR}/enclave_pch.h)
+    set(ENCLAVE_PCH_GCH ${ENCLAVE_PCH}.gch)
+    set(ENCLAVE_PCH_CONTENT "")
+    foreach(PCH_HEADER ${ENCLAVE_PCH_HEADERS})
+      string(APPEND ENCLAVE_PCH_CONTENT "#include \"${PCH_HEADER}\"\n")
+    endforeach()
+    # only touch the header when it changes, it would rebuild everything
+    file(WRITE ${ENCLAVE_PCH}.in "${ENCLAVE_PCH_CONTENT}")
+    configure_file(${ENCLAVE_PCH}.in ${ENCLAVE_PCH} COPYONLY)
+    add_custom_command(
+            OUTPUT ${ENCLAVE_PCH_GCH}
+            DEPENDS ${ENCLAVE_PCH} ${ENCLAVE_PCH_HEADERS}
+            COMMAND ${CXX} -std=c++17 -static -Wall -fno-stack-protector -D__TEE=1 -DREMOTE_ATTESTATION=1 ${COMPILER_INCLUDES} -I${SDK_INCLUDE_DIR} -I${CMAKE_CURRENT_BINARY_DIR} -I${CMAKE_BINARY_DIR}/inc
+                -I${LOCAL_ROOT_PATH}/inc/host_inc -I${LOCAL_ROOT_PATH}/inc/host_inc/penglai -I${LOCAL_ROOT_PATH}/inc/enclave_inc
+                -I${LOCAL_ROOT_PATH}/inc/enclave_inc/penglai ${ENCLAVE_CODEGEN_FLAGS} -x c++-header -o ${ENCLAVE_PCH_GCH} ${ENCLAVE_PCH}
+            COMMENT "generate ENCLAVE_PCH"
+        )
+    set(ENCLAVE_PCH_FLAGS -include ${ENCLAVE_PCH})
+  endif()
 
   foreach(SOURCE_FILE ${SOURCE_FILES})
     STRING(REGEX REPLACE ".+/(.+)\\..*" "\\1" SOURCE_FILE_NAME ${SOURCE_FILE})
     set(SOURCE_OBJ ${CMAKE_CURRENT_BINARY_DIR}/${SOURCE_FILE_NAME}.o)
     add_custom_command(
             OUTPUT ${SOURCE_OBJ}
-            DEPENDS ${SOURCE_FILES}
+            DEPENDS ${SOURCE_DEPENDS} ${ENCLAVE_PCH_GCH}
             COMMAND ${CXX} -std=c++17 -static -Wall -fno-stack-protector -D__TEE=1 -DREMOTE_ATTESTATION=1 ${COMPILER_INCLUDES} -I${SDK_INCLUDE_DIR} -I${CMAKE_CURRENT_BINARY_DIR} -I${CMAKE_BINARY_DIR}/inc
                 -I${LOCAL_ROOT_PATH}/inc/host_inc -I${LOCAL_ROOT_PATH}/inc/host_inc/penglai -I${LOCAL_ROOT_PATH}/inc/enclave_inc
-                -I${LOCAL_ROOT_PATH}/inc/enclave_inc/penglai -c -o ${SOURCE_OBJ} ${SOURCE_FILE}
+                -I${LOCAL_ROOT_PATH}/inc/enclave_inc/penglai ${ENCLAVE_CODEGEN_FLAGS} ${ENCLAVE_PCH_FLAGS} -c -o ${SOURCE_OBJ} ${SOURCE_FILE}
             COMMENT "generate SOURCE_OBJ"
         )
     list(APPEND SOURCE_C_OBJS ${SOURCE_OBJ})
@@ -265,7 +404,7 @@ if(CC_PL)
         DEPENDS ${AUTO_FILES}
         COMMAND ${CC} -static -Wall -fno-stack-protector -D__TEE=1 -DREMOTE_ATTESTATION=1 ${COMPILER_INCLUDES} -I${SDK_INCLUDE_DIR} -I${CMAKE_CURRENT_BINARY_DIR} -I${CMAKE_BINARY_DIR}/inc
             -I${LOCAL_ROOT_PATH}/inc/host_inc -I${LOCAL_ROOT_PATH}/inc/host_inc/penglai -I${LOCAL_ROOT_PATH}/inc/enclave_inc
-            -I${LOCAL_ROOT_PATH}/inc/enclave_inc/penglai -c -o ${APP_C_OBJ} ${CMAKE_CURRENT_BINARY_DIR}/${PREFIX}_t.c
+            -I${LOCAL_ROOT_PATH}/inc/enclave_inc/penglai ${ENCLAVE_CODEGEN_FLAGS} -c -o ${APP_C_OBJ} ${CMAKE_CURRENT_BINARY_DIR}/${PREFIX}_t.c
         COMMENT "generate APP_C_OBJ"
     )
   
@@ -277,13 +416,21 @@ if(CC_PL)
     COMMAND ${CC} -o ${META_SECTION} -c ${META_FILE}
   )
 
+  set(EMBED_SECTION ${CMAKE_CURRENT_BINARY_DIR}/embed.o)
+  add_custom_command(
+    OUTPUT ${EMBED_SECTION}
+    DEPENDS ${EMBED_FILE} ${EMBEDDED_FILES}
+    COMMAND ${CC} ${EMBED_FLAGS} -o ${EMBED_SECTION} -c ${EMBED_FILE}
+  )
+
   add_custom_command(
         OUTPUT ${CMAKE_CURRENT_SOURCE_DIR}/${OUTPUT}
-        DEPENDS ${APP_C_OBJ} ${SOURCE_C_OBJS} ${SDK_APP_LIB} ${MUSL_LIBC} ${GCC_LIB} ${META_SECTION}
-        COMMAND ${LD} -static -L${CMAKE_LIBRARY_OUTPUT_DIRECTORY} -L${SDK_LIB_DIR} -L${MUSL_LIB_DIR} -L/usr/lib64 -lsecgear_tee -lc -lpthread
-            -o ${CMAKE_CURRENT_SOURCE_DIR}/${OUTPUT} ${META_SECTION} ${CRT} ${APP_C_OBJ} ${SOURCE_C_OBJS} ${SECGEAR_TEE_LIB} ${SDK_APP_LIB} ${SDK_GM_LIB} ${STATIC_LIBS} ${MUSL_LIBCPP}
-             /usr/lib/libunwind.a ${MUSL_LIBC} ${GCC_LIB} ${MUSL_LIBATOMIC} /usr/lib/libjustworkaround.a -T ${CMAKE_CURRENT_SOURCE_DIR}/Enclave.lds
+        DEPENDS ${APP_C_OBJ} ${SOURCE_C_OBJS} ${SDK_APP_LIB} ${MUSL_LIBC} ${GCC_LIB} ${META_SECTION} ${EMBED_SECTION}
+        COMMAND ${ENCLAVE_LD} ${ENCLAVE_WRAP_LINK_FLAGS} -static -L${CMAKE_LIBRARY_OUTPUT_DIRECTORY} -L${SDK_LIB_DIR} -L${MUSL_LIB_DIR} -L/usr/lib64 -lsecgear_tee -lc -lpthread
+            -o ${CMAKE_CURRENT_SOURCE_DIR}/${OUTPUT} ${META_SECTION} ${EMBED_SECTION} ${CRT} ${APP_C_OBJ} ${SOURCE_C_OBJS} ${SECGEAR_TEE_LIB} ${SDK_APP_LIB} ${SDK_GM_LIB} ${STATIC_LIBS} ${MUSL_LIBCPP}
+             /usr/lib/libunwind.a ${ENCLAVE_GCOV_LIB} ${MUSL_LIBC} ${GCC_LIB} ${MUSL_LIBATOMIC} /usr/lib/libjustworkaround.a -T ${CMAKE_CURRENT_SOURCE_DIR}/Enclave.lds
         COMMAND chmod -x ${CMAKE_CURRENT_SOURCE_DIR}/${OUTPUT}
+        COMMAND ${SIZE} ${CMAKE_CURRENT_SOURCE_DIR}/${OUTPUT}
         COMMENT "generate penglai-ELF"
     )
   add_custom_target(
@@ -12,10 +12,9 @@ extern "C" int write_file(in_char* in_filename, int in_filename_len, in_char* in
     return 0;
 }
 
-extern "C" int get_emb_list(char out_list[sizeof(int) * MAX_EMB_CNT])
+extern "C" int get_emb_list(int* ids_out, int ids_out_cnt)
 {
     int cnt = 0;
-    int* p_list = (int*)out_list;
 
     std::vector<int> ids;
 
@@ -30,7 +29,7 @@ extern "C" int get_emb_list(char out_list[sizeof(int) * MAX_EMB_CNT])
             int id = std::stoi(match[1]);
             ids.push_back(id);
 
-            if (ids.size() >= MAX_EMB_CNT) {
+            if (ids.size() >= (size_t)ids_out_cnt) {
                 break;
             }
         }
@@ -38,7 +37,7 @@ extern "C" int get_emb_list(char out_list[sizeof(int) * MAX_EMB_CNT])
 
     std::sort(ids.begin(), ids.end());
     for (const auto id  : ids) {
-        p_list[cnt++] = id;
+        ids_out[cnt++] = id;
     }
 
     return cnt;
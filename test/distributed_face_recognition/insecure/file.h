@@ -4,7 +4,7 @@
 typedef char in_char;
 typedef char out_char;
 extern "C" int write_file(in_char* in_filename, int in_filename_len, in_char* in_content, int in_content_len);
-extern "C" int get_emb_list(char out_list[sizeof(int) * MAX_EMB_CNT]);
+extern "C" int get_emb_list(int* ids_out, int ids_out_cnt);
 extern "C" int read_file(char* in_filename, int in_filename_len, char* out_content, int out_content_len);
 
 // int img_recorder(std::array<char, IMG_SIZE> arr, int id);
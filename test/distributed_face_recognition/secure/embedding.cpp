@@ -10,6 +10,9 @@
 
 #include "net.h"
 #include "simpleocv.h"
+#ifdef __TEE
+#include "z_state.h"
+#endif
 // int __fprintf_chk(FILE *, int, const char *, ...);
 // int __sprintf_chk(char *, int, size_t, const char *, ...);
 #include <cstddef>
@@ -134,10 +137,8 @@ void print_float(float num)
     }
     print_num((int)(num * 10000));
 }
-int embedding(in_char img[IMG_SIZE], out_char res[EMBEDDING_SIZE])
+static void load_net(ncnn::Net &net)
 {
-    ncnn::Net net;
-
 #ifdef __TEE
     const int POOL_SIZE = 1024 * 1024 * 50;
     auto pool = new BitmapMemoryPool(malloc(POOL_SIZE), POOL_SIZE, 1024 * 16);
@@ -152,6 +153,26 @@ int embedding(in_char img[IMG_SIZE], out_char res[EMBEDDING_SIZE])
     eapp_print("LOADED PARAM\n");
     net.load_model(mobilefacenet_bin);
     eapp_print("LOADED MODEL\n");
+}
+
+#ifdef __TEE
+// the net is loaded once per enclave, and before the first call if the
+// host warms the enclave up
+static void warm_up_net()
+{
+    dtee::enclave_state<ncnn::Net>(load_net);
+}
+DTEE_WARMUP(warm_up_net);
+#endif
+
+int embedding(in_char img[IMG_SIZE], out_char res[EMBEDDING_SIZE])
+{
+#ifdef __TEE
+    ncnn::Net &net = dtee::enclave_state<ncnn::Net>(load_net);
+#else
+    ncnn::Net net;
+    load_net(net);
+#endif
     /* if
      * (net.load_param_bin(ncnn::DataReaderFromMemory(mobilefacenet_param_ptr)))
      */
@@ -249,7 +270,7 @@ int img_verifier(in_char arr[IMG_SIZE])
     int min_dist_id = -1;
 
     int emb_ids[MAX_EMB_CNT];
-    int emb_cnt = get_emb_list((char *)emb_ids);
+    int emb_cnt = get_emb_list(emb_ids, MAX_EMB_CNT);
     for (int i = 0; i < emb_cnt; i++) {
         int emb_id = emb_ids[i];
         std::string filename = "emb" + std::to_string(emb_id) + ".bin";
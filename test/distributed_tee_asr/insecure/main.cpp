@@ -1,3 +1,46 @@
+#include <stdio.h>
+
+#include <thread>
+
 #include "../secure/sherpa-ncnn.h"
+#ifdef __TEE
+#include "z_stream.h"
+#else
+#include "../secure/native_stream.h"
+#endif
+
+#define WAV_PATH "1089-134686-0001.wav"
+
+// prints the hypotheses as the enclave recognizes more of the clip
+static void print_text(void *ctx, const void *data, size_t len)
+{
+    (void)ctx;
+    fwrite(data, 1, len, stdout);
+    fflush(stdout);
+}
 
-int main() { speech_recognition(); }
+int main()
+{
+    dtee_stream wav = dtee_stream_open(64 * 1024);
+    // the enclave recognizes what was read so far while the rest comes in
+    std::thread reader([wav] {
+        FILE *f = fopen(WAV_PATH, "rb");
+        char buf[4096];
+        size_t n;
+        while (f != NULL && (n = fread(buf, 1, sizeof(buf), f)) != 0 &&
+               dtee_stream_write(wav, buf, n) == 0) {
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        dtee_stream_close(wav);
+    });
+    dtee_stream text = dtee_stream_open(4096);
+    dtee_stream_sink(text, print_text, NULL);
+    const int res = speech_recognition(wav, text);
+    reader.join();
+    dtee_stream_close(text);
+    dtee_stream_free(text);
+    dtee_stream_free(wav);
+    return res;
+}
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <chrono>  // NOLINT
+#include <cstring>
 #include <fstream>
 #include <iostream>
 
@@ -30,12 +31,71 @@
 #include "joiner_jit_trace-pnnx.ncnn.id.h"
 #include "joiner_jit_trace-pnnx.ncnn.mem.h"
 #include "net.h"  // NOLINT
+#include "sherpa-ncnn.h"
 #include "sherpa-ncnn/csrc/recognizer.h"
-#include "sherpa-ncnn/csrc/wave-reader.h"
 #include "tokens.h"
-#include "wav.h"
+#ifdef __TEE
+#include "z_stream.h"
+#include "z_threads.h"
+#else
+#include "native_stream.h"
+#endif
 
-int speech_recognition()
+// samples per read, 0.1s at 16kHz
+#define CHUNK_SAMPLES 1600
+
+// skips the chunks of the RIFF header up to the samples of a 16 bit mono
+// wave, false if it isn't one
+static bool read_wave_header(dtee_stream wav, int32_t *sampling_rate)
+{
+    char riff[12];
+    if (dtee_stream_read(wav, riff, sizeof(riff)) != sizeof(riff) ||
+        memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+    bool has_format = false;
+    for (;;) {
+        char head[8];
+        if (dtee_stream_read(wav, head, sizeof(head)) != sizeof(head)) {
+            return false;
+        }
+        uint32_t size;
+        memcpy(&size, head + 4, sizeof(size));
+        if (memcmp(head, "data", 4) == 0) {
+            return has_format;
+        }
+        std::vector<char> body(size + size % 2);
+        if (dtee_stream_read(wav, body.data(), body.size()) != body.size()) {
+            return false;
+        }
+        if (memcmp(head, "fmt ", 4) == 0 && size >= 16) {
+            int16_t format, channels, bits;
+            memcpy(&format, body.data(), 2);
+            memcpy(&channels, body.data() + 2, 2);
+            memcpy(sampling_rate, body.data() + 4, 4);
+            memcpy(&bits, body.data() + 14, 2);
+            if (format != 1 || channels != 1 || bits != 16) {
+                return false;
+            }
+            has_format = true;
+        }
+    }
+}
+
+// sends the hypothesis to the host, a line each time it changes
+static void send_hypothesis(dtee_stream text, const std::string &hyp,
+                            std::string *last)
+{
+    if (hyp == *last) {
+        return;
+    }
+    *last = hyp;
+    const std::string line = hyp + "\n";
+    dtee_stream_write(text, line.data(), line.size());
+    dtee_stream_flush(text);
+}
+
+int speech_recognition(dtee_stream wav, dtee_stream text)
 {
     sherpa_ncnn::RecognizerConfig config;
     config.model_config.encoder_param_data =
@@ -50,7 +110,12 @@ int speech_recognition()
     config.model_config.tokens_data = tokens_txt;
     config.model_config.tokens_size = tokens_txt_len;
 
+#ifdef __TEE
+    // the threads of ncnn run on the host threads of z_threads.h
+    int32_t num_threads = dtee_enclave_threads();
+#else
     int32_t num_threads = 1;
+#endif
     config.model_config.encoder_opt.num_threads = num_threads;
     config.model_config.decoder_opt.num_threads = num_threads;
     config.model_config.joiner_opt.num_threads = num_threads;
@@ -62,17 +127,31 @@ int speech_recognition()
 
     sherpa_ncnn::Recognizer recognizer(config);
 
-    bool is_ok = false;
-    std::vector<float> samples = sherpa_ncnn::ReadWave(
-        __0_wav, __0_wav_len, expected_sampling_rate, &is_ok);
-    if (!is_ok) {
+    int32_t sampling_rate = 0;
+    if (!read_wave_header(wav, &sampling_rate) ||
+        sampling_rate != expected_sampling_rate) {
         exit(-1);
     }
 
-    const float duration = samples.size() / expected_sampling_rate;
+    // decoded as the samples arrive, not once the whole clip is there
     auto stream = recognizer.CreateStream();
-    stream->AcceptWaveform(expected_sampling_rate, samples.data(),
-                           samples.size());
+    int16_t pcm[CHUNK_SAMPLES];
+    std::vector<float> samples(CHUNK_SAMPLES);
+    std::string hyp;
+    for (;;) {
+        const size_t n = dtee_stream_read(wav, pcm, sizeof(pcm)) / 2;
+        if (n == 0) {
+            break;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            samples[i] = pcm[i] / 32768.0f;
+        }
+        stream->AcceptWaveform(expected_sampling_rate, samples.data(), n);
+        while (recognizer.IsReady(stream.get())) {
+            recognizer.DecodeStream(stream.get());
+        }
+        send_hypothesis(text, recognizer.GetResult(stream.get()).text, &hyp);
+    }
     std::vector<float> tail_paddings(
         static_cast<int>(0.3 * expected_sampling_rate));
     stream->AcceptWaveform(expected_sampling_rate, tail_paddings.data(),
@@ -83,6 +162,7 @@ int speech_recognition()
     }
 
     auto result = recognizer.GetResult(stream.get());
+    send_hypothesis(text, result.text, &hyp);
 
     eapp_print("%s\n", result.ToString().c_str());
 
@@ -1 +1,4 @@
-int speech_recognition();
+// the waveform comes as the host reads it and the text goes back as it's
+// recognized, see z_stream.h
+typedef int dtee_stream;
+int speech_recognition(dtee_stream wav, dtee_stream text);
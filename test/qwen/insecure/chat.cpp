@@ -1,8 +1,15 @@
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "../secure/llm.h"
 #include "file_stub.h"
+#ifdef __TEE
+#include "z_state.h"
+#include "z_stream.h"
+#else
+#include "../secure/native_stream.h"
+#endif
 #define USED(x) ((void)(x))
 
 std::string construct_prompt(std::string user_prompt)
@@ -23,21 +30,47 @@ std::string construct_prompt(std::string user_prompt)
 
 #define DEFAULT_PROMPT "Who are you?"
 
+// prints the reply as the enclave generates it
+static void print_tokens(void *ctx, const void *data, size_t len)
+{
+    USED(ctx);
+    fwrite(data, 1, len, stdout);
+    fflush(stdout);
+}
+
 int main(int argc, char **argv)
 {
     printf("OK\n");
     USED(read_file);
-    std::string prompt;
-    if (argc == 1) {
-        prompt = construct_prompt(DEFAULT_PROMPT);
+    // each arg is a turn of one conversation
+    std::vector<std::string> prompts;
+    for (int i = 1; i < argc; ++i) {
+        prompts.push_back(construct_prompt(argv[i]));
     }
-    else if (argc == 2) {
-        prompt = construct_prompt(argv[1]);
-    }
-    else {
-        printf("Usage: %s [prompt] or %s\n", argv[0], argv[0]);
+    if (prompts.empty()) {
+        prompts.push_back(construct_prompt(DEFAULT_PROMPT));
     }
 
-    /* char user_input[] = "<user_prompt>who are you<model_prompt>\n"; */
-    llm_inference((char *)prompt.c_str(), prompt.size());
+#ifdef __TEE
+    // the model stays loaded in the enclave from one turn to the next
+    dtee_enclave_warmup();
+#endif
+    const int session = llm_session_open();
+    if (session == -1) {
+        printf("no session\n");
+        return 1;
+    }
+    dtee_stream reply = dtee_stream_open(4096);
+    dtee_stream_sink(reply, print_tokens, NULL);
+    for (auto &prompt : prompts) {
+        llm_session_chat(session, (char *)prompt.c_str(), prompt.size(),
+                         reply);
+        printf("\n");
+    }
+    dtee_stream_close(reply);
+    dtee_stream_free(reply);
+    llm_session_close(session);
+#ifdef __TEE
+    dtee_enclave_release();
+#endif
 }
@@ -2,12 +2,24 @@
 
 #include <TEE-Capability/common.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#ifdef __TEE
+#include "z_state.h"
+#include "z_stream.h"
+#include "z_threads.h"
+#else
+#include "native_stream.h"
+#endif
+
 int cnt = 0;
 int max_cnt = 0;
 std::unordered_map<void*, int> g_alloc_map;
@@ -34,7 +46,6 @@ static void unrecord(void* ptr)
     g_alloc_map[ptr] = 0;
 }
 #endif
-#include "../insecure/file_stub.h"
 #include "common/common.h"
 #include "llama.h"
 
@@ -72,233 +83,16 @@ extern "C"
 
 #define BUF_LEN 1024
 
-int run(const char* prompt)
-{
-    gpt_params params;
-    params.n_threads = 1;
-    params.n_threads_batch = 1;
-    params.prompt = prompt;
-    params.model = "qwen-model";
-    params.seed = 691;
-    eapp_print("OK\n");
-    // log_disable();
-    eapp_print("OK\n");
-
-    llama_sampling_params& sparams = params.sparams;
-    std::mt19937 rng(params.seed);
-    malloc(31);
-    eapp_print("OK\n");
-
-    llama_backend_init();
-    eapp_print("OK\n");
-    // llama_numa_init(params.numa);
-
-    llama_model* model;
-    llama_context* ctx;
-    llama_context* ctx_guidance = NULL;
-
-    std::tie(model, ctx) = llama_init_from_gpt_params(params);
-    eapp_print("OK\n");
-    if (model == NULL) {
-        eapp_print("%s: error: unable to load model\n", __func__);
-        return 1;
-    }
-
-    const int n_ctx_train = llama_n_ctx_train(model);
-    const int n_ctx = llama_n_ctx(ctx);
-
-    const bool add_bos = llama_should_add_bos_token(model);
-
-    std::vector<llama_token> embd_inp;
-    embd_inp = ::llama_tokenize(ctx, params.prompt, add_bos, true);
-
-    if ((int)embd_inp.size() > n_ctx - 4) {
-        eapp_print("%s: error: prompt is too long (%d tokens, max %d)\n",
-                   __func__, (int)embd_inp.size(), n_ctx - 4);
-        return 1;
-    }
-
-    // number of tokens to keep when resetting context
-    if (params.n_keep < 0 || params.n_keep > (int)embd_inp.size() ||
-        params.instruct || params.chatml) {
-        params.n_keep = (int)embd_inp.size();
-    }
-    else {
-        params.n_keep += add_bos;  // always keep the BOS token
-    }
-
-    int n_past = 0;
-    int n_remain = params.n_predict;
-    int n_consumed = 0;
-
-    std::vector<llama_token> embd;
-    std::vector<llama_token> embd_guidance;
-
-    struct llama_sampling_context* ctx_sampling = llama_sampling_init(sparams);
-
-    while (n_remain != 0) {
-        // predict
-        if (!embd.empty()) {
-            eapp_print("");
-            int max_embd_size = n_ctx - 4;
-
-            // Ensure the input doesn't exceed the context size by truncating
-            // embd if necessary.
-            if ((int)embd.size() > max_embd_size) {
-                const int skipped_tokens = (int)embd.size() - max_embd_size;
-                embd.resize(max_embd_size);
-
-                fflush(stdout);
-            }
-
-            for (int i = 0; i < (int)embd.size(); i += params.n_batch) {
-                int n_eval = (int)embd.size() - i;
-                if (n_eval > params.n_batch) {
-                    n_eval = params.n_batch;
-                }
-
-                if (llama_decode(ctx, llama_batch_get_one(&embd[i], n_eval,
-                                                          n_past, 0))) {
-                    eapp_print("%s : failed to eval\n", __func__);
-                    return 1;
-                }
-
-                n_past += n_eval;
-            }
-        }
-
-        embd.clear();
-        embd_guidance.clear();
-
-        eapp_print("");
-        if ((int)embd_inp.size() <= n_consumed) {
-            const llama_token id =
-                llama_sampling_sample(ctx_sampling, ctx, ctx_guidance);
-
-            llama_sampling_accept(ctx_sampling, ctx, id, true);
-            embd.push_back(id);
-
-            // decrement remaining sampling budget
-            --n_remain;
-        }
-        else {
-            // some user input remains from prompt or interaction, forward it to
-            // processing
-            while ((int)embd_inp.size() > n_consumed) {
-                embd.push_back(embd_inp[n_consumed]);
-
-                llama_sampling_accept(ctx_sampling, ctx, embd_inp[n_consumed],
-                                      false);
-
-                ++n_consumed;
-                if ((int)embd.size() >= params.n_batch) {
-                    break;
-                }
-            }
-        }
-        eapp_print("");
-
-        // display text
-        for (auto id : embd) {
-            const std::string token_str = llama_token_to_piece(ctx, id);
-            eapp_print("%s", token_str.c_str());
-        }
-        fflush(stdout);
-
-        // end of text token
-        if (!embd.empty() && embd.back() == llama_token_eos(model)) {
-            eapp_print(" [end of text]\n");
-            break;
-        }
-    }
-    llama_free(ctx);
-    llama_free_model(model);
-
-    llama_sampling_free(ctx_sampling);
-    llama_backend_free();
-
-    return 0;
-}
-
 extern "C"
 {
-    static size_t buf_pos = 0;
-    static size_t buf_end = 0;
-    FILE* my_fopen(const char* __restrict __filename,
-                   const char* __restrict __modes)
+    // the model is read from the host through the buffered ocalls of
+    // z_stdio.h, dteegen wraps the stdio calls of the enclave
+    FILE* model_fopen(const char* __restrict __filename,
+                      const char* __restrict __modes)
     {
-        buf_pos = 0;
-        buf_end = 0;
         __filename = "qwen-model";
         eapp_print("FILENAME: %s\n", __filename);
-        return (FILE*)(open_file((char*)__filename, strlen(__filename) + 1));
-    }
-
-    size_t my_fread(void* __restrict ptr, size_t size, size_t n,
-                    FILE* __restrict stream)
-    {
-        static char buf[4096 * 10];
-        // eapp_print("------------BEGIN ERAD %d x %d-----------\n", (int)size,
-        // (int)n, (void*)ptr);
-        if (stream == NULL) {
-            eapp_print("stream is NULL\n");
-            return 0;
-        }
-        auto p = (char*)ptr;
-        int t0 = 0;
-        size_t remain = size * n;
-        // read_file((size_t)stream, 1, remain, (char*)ptr, remain);
-        while (remain > 0) {
-            if (buf_pos >= buf_end) {
-                // eapp_print("OCALL BEGIN\n");
-                buf_end = read_file((size_t)stream, 1, sizeof(buf), (char*)buf,
-                                    sizeof(buf));
-                // eapp_print("OCALL END, buf_end: %lu, %d\n", buf_end,
-                //            (int)buf[0]);
-                buf_pos = 0;
-            }
-            int read_end = std::min(buf_end, buf_pos + remain);
-            int read_len = read_end - buf_pos;
-            // eapp_print("from: %p to: %p len: %d\n", buf + buf_pos, p,
-            // read_len);
-
-            memcpy(p, buf + buf_pos, read_len);
-            if (p == ptr) t0 = ((char*)p)[0];
-            // break;
-
-            p += read_len;
-            buf_pos += read_len;
-            remain -= read_len;
-        }
-
-        // eapp_print("------------END ERAD-----------\n");
-        return n;
-    }
-
-    size_t my_fwrite(const void* __restrict __ptr, size_t __size, size_t __n,
-                     FILE* __restrict __s)
-    {
-        eapp_print("WRITE: %lu x %lu at %p\n", __size, __n, __ptr);
-        eapp_print("fwrite is not supported now.\n");
-        return 0;
-    }
-
-    int my_fclose(FILE* __stream)
-    {
-        eapp_print("CLOSE\n");
-        return close_file((size_t)__stream);
-    }
-
-    int my_fseek(FILE* __stream, long int __offset, int __whence)
-    {
-        eapp_print("SEEK\n");
-        return seek_file((size_t)__stream, __offset, __whence);
-    }
-
-    long int my_ftell(FILE* __stream)
-    {
-        eapp_print("TELL\n");
-        return tell_file((size_t)__stream);
+        return fopen(__filename, __modes);
     }
 
     typedef void* (*malloc_type)(size_t __size);
@@ -540,33 +334,19 @@ void manual_init_array(void)
 }
 #endif
 
-int llm_inference(char* user_input, int user_input_len)
+// the allocator and file hooks the enclave build of llama calls
+static void install_hooks()
 {
-    eapp_print("HEAP: %p\n", g_mem);
-    // g_mem = (char*)malloc(HEAP_LEN + 8);
-    // ta_init(g_mem, g_mem + HEAP_LEN, 1024 * 512, 1024 * 64, 8);
-    // g_tlsf_pool = tlsf_create_with_pool(g_mem, HEAP_LEN);
-    // mp = MemoryPoolInit(MEMPOOL_SIZE, MEMPOOL_SIZE);
-    // if (!mp) eapp_print("FAIL TO INIT MEM POOL\n");
-    // my_malloc(100);
-    // eapp_print("HEAP: %p\n", g_mem);
-    // *(uint32_t*)g_mem = HEAP_LEN;
-    // *(uint32_t*)((g_mem) + 4 + HEAP_LEN) = 0;
-    // #ifdef __TEE
-    //     g_malloc = my_malloc;
-    //     g_free = my_free;
-    // #endif
-    //
     malloc(31);
 
     eapp_print("HEAP: %p\n", g_mem);
     // manual_init_array();
-    g_io_helper.fread = my_fread;
-    g_io_helper.fopen = my_fopen;
-    g_io_helper.fclose = my_fclose;
-    g_io_helper.fwrite = my_fwrite;
-    g_io_helper.fseek = my_fseek;
-    g_io_helper.ftell = my_ftell;
+    g_io_helper.fread = fread;
+    g_io_helper.fopen = model_fopen;
+    g_io_helper.fclose = fclose;
+    g_io_helper.fwrite = fwrite;
+    g_io_helper.fseek = fseek;
+    g_io_helper.ftell = ftell;
     // g_my_posix_memalign = my_posix_memalign;
     // g_my_malloc = my_malloc;
     // g_my_free = my_free;
@@ -575,9 +355,305 @@ int llm_inference(char* user_input, int user_input_len)
     g_my_malloc = my_malloc;
     g_my_free = my_free;
     g_my_calloc = my_calloc;
+}
 
-    run(user_input);
+// tokens the KV cache holds for all sessions together
+#define LLM_N_CTX 2048
+#define LLM_MAX_SESSIONS 8
 
-    eapp_print("MAX CNT: %d\n", max_cnt);
+// a conversation, the KV cache holds it as the sequence of the session's
+// index. It stays there once the session is closed, for later sessions
+// which start with the same prompt
+struct llm_session
+{
+    bool open = false;
+    // the conversation so far, the first n_past tokens are in the KV cache
+    std::vector<llama_token> tokens;
+    int n_past = 0;
+    llama_sampling_context* sampling = NULL;
+    // when it was used last, the least recent session is evicted first
+    uint64_t used = 0;
+};
+
+// the model and one context, loaded once per enclave
+struct llm_engine
+{
+    gpt_params params;
+    llama_model* model = NULL;
+    llama_context* ctx = NULL;
+    llm_session sessions[LLM_MAX_SESSIONS];
+    uint64_t clock = 0;
+    // held for a whole call, the sessions share the context and host
+    // callers may enter at once
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+};
+
+// holds the engine for a scope, spinning like dtee::state_lock as the
+// enclave can't block
+struct engine_lock
+{
+    explicit engine_lock(llm_engine& e) : flag(e.lock)
+    {
+        while (flag.test_and_set(std::memory_order_acquire)) {
+        }
+    }
+    ~engine_lock() { flag.clear(std::memory_order_release); }
+    engine_lock(const engine_lock&) = delete;
+    engine_lock& operator=(const engine_lock&) = delete;
+
+    std::atomic_flag& flag;
+};
+
+static size_t load_engine(llm_engine& e)
+{
+    install_hooks();
+#ifdef __TEE
+    // ggml's threads run on the host threads of z_threads.h
+    e.params.n_threads = dtee_enclave_threads();
+#else
+    e.params.n_threads = 1;
+#endif
+    e.params.n_threads_batch = e.params.n_threads;
+    e.params.n_ctx = LLM_N_CTX;
+    e.params.model = "qwen-model";
+    e.params.seed = 691;
+    llama_backend_init();
+    std::tie(e.model, e.ctx) = llama_init_from_gpt_params(e.params);
+    if (e.model == NULL || e.ctx == NULL) {
+        eapp_print("%s: error: unable to load model\n", __func__);
+        return 0;
+    }
+    return llama_model_size(e.model) + llama_get_state_size(e.ctx);
+}
+
+static llm_engine& engine()
+{
+#ifdef __TEE
+    return dtee::enclave_state<llm_engine>(load_engine);
+#else
+    // loaded once, as the enclave does
+    static llm_engine* e = [] {
+        llm_engine* res = new llm_engine();
+        load_engine(*res);
+        return res;
+    }();
+    return *e;
+#endif
+}
+
+#ifdef __TEE
+// the model is loaded once per enclave, and before the first turn if the
+// host warms the enclave up
+static void warm_up_engine()
+{
+    engine();
+}
+DTEE_WARMUP(warm_up_engine);
+#endif
+
+static llm_session* session_of(llm_engine& e, int session)
+{
+    if (e.ctx == NULL || session < 0 || session >= LLM_MAX_SESSIONS ||
+        !e.sessions[session].open) {
+        return NULL;
+    }
+    return &e.sessions[session];
+}
+
+// frees the KV cells of the least recently used session but keep, closed
+// ones first. An open one evaluates its conversation again when it's next
+// used. false if there's none to evict
+static bool evict(llm_engine& e, int keep)
+{
+    int victim = -1;
+    for (int i = 0; i < LLM_MAX_SESSIONS; ++i) {
+        const llm_session& s = e.sessions[i];
+        if (i == keep || s.n_past == 0) {
+            continue;
+        }
+        if (victim == -1 || std::make_pair(s.open, s.used) <
+                                std::make_pair(e.sessions[victim].open,
+                                               e.sessions[victim].used)) {
+            victim = i;
+        }
+    }
+    if (victim == -1) {
+        return false;
+    }
+    llm_session& s = e.sessions[victim];
+    llama_kv_cache_seq_rm(e.ctx, victim, -1, -1);
+    s.n_past = 0;
+    if (!s.open) {
+        s.tokens.clear();
+    }
+    llama_kv_cache_defrag(e.ctx);
+    return true;
+}
+
+// takes the longest prefix of the conversation some other session has in
+// the KV cache, the cells are shared and not evaluated again
+static void reuse_prefix(llm_engine& e, int session)
+{
+    llm_session& s = e.sessions[session];
+    if (s.n_past != 0 || s.tokens.empty()) {
+        return;
+    }
+    int from = -1;
+    size_t best = 0;
+    for (int i = 0; i < LLM_MAX_SESSIONS; ++i) {
+        const llm_session& other = e.sessions[i];
+        if (i == session) {
+            continue;
+        }
+        // the last token is evaluated anyway, for the logits after it
+        const size_t n = std::min((size_t)other.n_past, s.tokens.size() - 1);
+        const size_t common =
+            std::mismatch(s.tokens.begin(), s.tokens.begin() + n,
+                          other.tokens.begin())
+                .first -
+            s.tokens.begin();
+        if (common > best) {
+            from = i;
+            best = common;
+        }
+    }
+    if (from != -1) {
+        llama_kv_cache_seq_cp(e.ctx, from, session, 0, (llama_pos)best);
+        s.n_past = (int)best;
+    }
+}
+
+// evaluates what the KV cache doesn't have of the conversation yet
+static bool eval_pending(llm_engine& e, int session)
+{
+    llm_session& s = e.sessions[session];
+    while (s.n_past < (int)s.tokens.size()) {
+        const int n_eval = std::min((int)s.tokens.size() - s.n_past,
+                                    (int)e.params.n_batch);
+        const int res = llama_decode(
+            e.ctx, llama_batch_get_one(&s.tokens[s.n_past], n_eval, s.n_past,
+                                       session));
+        if (res < 0 || (res > 0 && !evict(e, session))) {
+            return false;
+        }
+        if (res == 0) {
+            s.n_past += n_eval;
+        }
+    }
+    return true;
+}
+
+int llm_session_open(void)
+{
+    llm_engine& e = engine();
+    engine_lock lock(e);
+    if (e.ctx == NULL) {
+        return -1;
+    }
+    // a closed session without cached tokens, or the least recent one
+    int session = -1;
+    for (int i = 0; i < LLM_MAX_SESSIONS; ++i) {
+        const llm_session& s = e.sessions[i];
+        if (!s.open &&
+            (session == -1 ||
+             std::make_pair(s.n_past != 0, s.used) <
+                 std::make_pair(e.sessions[session].n_past != 0,
+                                e.sessions[session].used))) {
+            session = i;
+        }
+    }
+    if (session == -1) {
+        return -1;
+    }
+    llm_session& s = e.sessions[session];
+    llama_kv_cache_seq_rm(e.ctx, session, -1, -1);
+    s.tokens.clear();
+    s.n_past = 0;
+    s.sampling = llama_sampling_init(e.params.sparams);
+    s.used = ++e.clock;
+    s.open = true;
+    return session;
+}
+
+int llm_session_chat(int session, shared_char* user_input, int user_input_len,
+                     dtee_stream out)
+{
+    llm_engine& e = engine();
+    engine_lock lock(e);
+    llm_session* s = session_of(e, session);
+    if (s == NULL || user_input_len <= 0) {
+        return 1;
+    }
+    s->used = ++e.clock;
+    // the host can still change it, work on a copy
+    const std::string prompt(user_input, user_input_len);
+    const bool add_bos =
+        s->tokens.empty() && llama_should_add_bos_token(e.model);
+    const std::vector<llama_token> input =
+        ::llama_tokenize(e.ctx, prompt, add_bos, true);
+    const int n_ctx = llama_n_ctx(e.ctx);
+    if ((int)(s->tokens.size() + input.size()) > n_ctx - 4) {
+        eapp_print("%s: error: prompt is too long (%d tokens, max %d)\n",
+                   __func__, (int)(s->tokens.size() + input.size()),
+                   n_ctx - 4);
+        return 1;
+    }
+    for (llama_token id : input) {
+        s->tokens.push_back(id);
+        llama_sampling_accept(s->sampling, e.ctx, id, false);
+    }
+    reuse_prefix(e, session);
+
+    for (int n_remain = e.params.n_predict; n_remain != 0; --n_remain) {
+        if (!eval_pending(e, session)) {
+            eapp_print("%s : failed to eval\n", __func__);
+            return 1;
+        }
+        if ((int)s->tokens.size() >= n_ctx - 4) {
+            break;
+        }
+        const llama_token id = llama_sampling_sample(s->sampling, e.ctx, NULL);
+        llama_sampling_accept(s->sampling, e.ctx, id, true);
+        // the next turn evaluates it with its input
+        s->tokens.push_back(id);
+        if (id == llama_token_eos(e.model)) {
+            eapp_print(" [end of text]\n");
+            break;
+        }
+        const std::string token_str = llama_token_to_piece(e.ctx, id);
+        eapp_print("%s", token_str.c_str());
+        dtee_stream_write(out, token_str.data(), token_str.size());
+        // a token takes a while, the host shows each one as it comes
+        dtee_stream_flush(out);
+    }
+    return 0;
+}
+
+int llm_session_close(int session)
+{
+    llm_engine& e = engine();
+    engine_lock lock(e);
+    llm_session* s = session_of(e, session);
+    if (s == NULL) {
+        return 1;
+    }
+    s->open = false;
+    llama_sampling_free(s->sampling);
+    s->sampling = NULL;
+    // only what the KV cache has is a prefix to reuse
+    s->tokens.resize(s->n_past);
     return 0;
 }
+
+int llm_inference(shared_char* user_input, int user_input_len,
+                  dtee_stream out)
+{
+    const int session = llm_session_open();
+    if (session == -1) {
+        return 1;
+    }
+    const int res = llm_session_chat(session, user_input, user_input_len, out);
+    llm_session_close(session);
+    eapp_print("MAX CNT: %d\n", max_cnt);
+    return res;
+}
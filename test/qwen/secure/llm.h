@@ -1 +1,20 @@
-int llm_inference(char *user_input, int user_input_len);
+// the prompt crosses in the shared region instead of being copied, see
+// z_shared.h. The reply comes back token by token through out, see
+// z_stream.h
+typedef char shared_char;
+typedef int dtee_stream;
+
+// a conversation whose prompt and replies stay in the enclave's KV cache,
+// so each turn only evaluates its own input. -1 if all sessions are open.
+// The sessions share one context, calls from several host threads take
+// turns
+int llm_session_open(void);
+// adds user_input to the conversation and generates the reply
+int llm_session_chat(int session, shared_char *user_input, int user_input_len,
+                     dtee_stream out);
+// its KV cache stays, for later sessions starting with the same prompt
+int llm_session_close(int session);
+
+// one turn in a session of its own
+int llm_inference(shared_char *user_input, int user_input_len,
+                  dtee_stream out);
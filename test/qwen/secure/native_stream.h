@@ -0,0 +1,145 @@
+// the streams of z_stream.h for the sample built on its own, without
+// dteegen: both worlds run in one process, a stream is a buffer they share.
+// dteegen trees define __TEE and get z_stream.h instead.
+#pragma once
+#include <stddef.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+typedef int dtee_stream;
+
+struct native_stream
+{
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<char> buf;
+    size_t capacity = 0;
+    bool closed = false;
+    void (*sink)(void *ctx, const void *data, size_t len) = NULL;
+    void *sink_ctx = NULL;
+};
+
+struct native_stream_table
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<native_stream>> streams;
+};
+
+inline native_stream_table &native_streams()
+{
+    static native_stream_table table;
+    return table;
+}
+
+inline native_stream *native_stream_of(dtee_stream s)
+{
+    native_stream_table &t = native_streams();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    return s >= 0 && (size_t)s < t.streams.size() ? t.streams[s].get()
+                                                  : NULL;
+}
+
+inline dtee_stream dtee_stream_open(size_t capacity)
+{
+    native_stream_table &t = native_streams();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    t.streams.push_back(std::make_unique<native_stream>());
+    t.streams.back()->capacity = std::max<size_t>(capacity, 1);
+    return (dtee_stream)t.streams.size() - 1;
+}
+
+inline void dtee_stream_close(dtee_stream s)
+{
+    if (native_stream *st = native_stream_of(s)) {
+        std::lock_guard<std::mutex> lock(st->mutex);
+        st->closed = true;
+        st->changed.notify_all();
+    }
+}
+
+inline void dtee_stream_free(dtee_stream s)
+{
+    native_stream_table &t = native_streams();
+    std::lock_guard<std::mutex> lock(t.mutex);
+    if (s >= 0 && (size_t)s < t.streams.size()) {
+        t.streams[s].reset();
+    }
+}
+
+inline void dtee_stream_sink(dtee_stream s,
+                             void (*sink)(void *ctx, const void *data,
+                                          size_t len),
+                             void *ctx)
+{
+    if (native_stream *st = native_stream_of(s)) {
+        std::lock_guard<std::mutex> lock(st->mutex);
+        st->sink = sink;
+        st->sink_ctx = ctx;
+    }
+}
+
+inline int dtee_stream_write(dtee_stream s, const void *data, size_t len)
+{
+    native_stream *st = native_stream_of(s);
+    if (st == NULL) {
+        return -1;
+    }
+    std::unique_lock<std::mutex> lock(st->mutex);
+    if (st->closed) {
+        return -1;
+    }
+    if (st->sink != NULL) {
+        st->sink(st->sink_ctx, data, len);
+        return 0;
+    }
+    const char *p = (const char *)data;
+    while (len != 0) {
+        st->changed.wait(lock, [st] {
+            return st->closed || st->buf.size() < st->capacity;
+        });
+        if (st->closed) {
+            return -1;
+        }
+        const size_t n = std::min(len, st->capacity - st->buf.size());
+        st->buf.insert(st->buf.end(), p, p + n);
+        p += n;
+        len -= n;
+        st->changed.notify_all();
+    }
+    return 0;
+}
+
+inline size_t dtee_stream_read(dtee_stream s, void *buf, size_t len)
+{
+    native_stream *st = native_stream_of(s);
+    if (st == NULL) {
+        return 0;
+    }
+    std::unique_lock<std::mutex> lock(st->mutex);
+    char *out = (char *)buf;
+    size_t got = 0;
+    while (got < len) {
+        st->changed.wait(lock,
+                         [st] { return st->closed || !st->buf.empty(); });
+        if (st->buf.empty()) {
+            break;
+        }
+        const size_t n = std::min(len - got, st->buf.size());
+        std::copy(st->buf.begin(), st->buf.begin() + n, out + got);
+        st->buf.erase(st->buf.begin(), st->buf.begin() + n);
+        got += n;
+        st->changed.notify_all();
+    }
+    return got;
+}
+
+// writes go to the buffer or the sink right away
+inline int dtee_stream_flush(dtee_stream s)
+{
+    return native_stream_of(s) != NULL ? 0 : -1;
+}
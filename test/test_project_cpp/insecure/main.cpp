@@ -165,5 +165,35 @@ int main(int argc, char *argv[])
 
     std::cout << pi() << std::endl;
     std::cout << get_e() << std::endl;
+
+    char bytes[16];
+    for (int i = 0; i < 16; ++i) {
+        bytes[i] = i;
+    }
+    if (sum_bytes(bytes) != 120) {
+        std::cout << "sum_bytes: wrong sum" << std::endl;
+        return 1;
+    }
+    if (fill_bytes(bytes) != 16) {
+        std::cout << "fill_bytes: wrong count" << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < 16; ++i) {
+        if (bytes[i] != 7) {
+            std::cout << "fill_bytes: not copied back" << std::endl;
+            return 1;
+        }
+    }
+    if (cond_write(bytes, 1) != 16 || bytes[0] != 1 || bytes[15] != 2) {
+        std::cout << "cond_write: not copied back" << std::endl;
+        return 1;
+    }
+    const vec2 in[3] = {{1, 2}, {3, 4}, {5, 6}};
+    vec2 out[3] = {};
+    if (move_points({10, 0}, AXIS_Y, 0.5, in, 3, out, 3) != 3 ||
+        out[2].x != 5 || out[2].y != 13) {
+        std::cout << "move_points: not copied back" << std::endl;
+        return 1;
+    }
     return 0;
 }
@@ -1,5 +1,6 @@
 #include "add.h"
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -22,6 +23,14 @@ class Object
 };
 static Object s("global static object ctor");
 
+// named like std::copy, but writes its first argument
+void copy(char *dst, int n, char c)
+{
+    for (int i = 0; i < n; ++i) {
+        dst[i] = c;
+    }
+}
+
 int add_internal(int x, int y)
 {
     eapp_print("s.len: %d\n", (int)s.len());
@@ -31,6 +40,46 @@ int add_internal(int x, int y)
 }  // namespace
 int add(int x, int y) { return add_internal(x, y); }
 
+int sum_bytes(char bytes[16])
+{
+    std::vector<char> v(16);
+    std::copy(bytes, bytes + 16, v.begin());
+    int res = 0;
+    for (const char c : v) {
+        res += c;
+    }
+    return res;
+}
+
+int fill_bytes(char bytes[16])
+{
+    copy(bytes, 16, 7);
+    return 16;
+}
+
+int cond_write(char bytes[16], int first)
+{
+    char tmp[16];
+    for (int i = 0; i < 16; ++i) {
+        (first ? bytes[i] : tmp[i]) = 1;
+    }
+    (tmp[0] = 0, bytes[15]) = 2;
+    return 16;
+}
+
+int move_points(struct vec2 origin, enum axis along, double scale,
+                const struct vec2 *in, int in_cnt, struct vec2 *out,
+                int out_cnt)
+{
+    const int n = std::min(in_cnt, out_cnt);
+    for (int i = 0; i < n; ++i) {
+        out[i] = in[i];
+        int &coord = along == AXIS_X ? out[i].x : out[i].y;
+        coord = origin.x + origin.y + (int)(coord * scale);
+    }
+    return n;
+}
+
 float addf(float x, float y)
 {
     return (x + y) * get_num();
@@ -4,3 +4,22 @@ float addf(float x, float y);
 
 float pi();
 float get_e();
+
+// only read, so copied into the enclave but not back
+int sum_bytes(char bytes[16]);
+// written through a copy of the project's own, copied both ways
+int fill_bytes(char bytes[16]);
+// written through a conditional and a comma, copied both ways
+int cond_write(char bytes[16], int first);
+
+// cross by value, and as buffers sized in elements by the _cnt after them
+struct vec2
+{
+    int x;
+    int y;
+};
+enum axis { AXIS_X, AXIS_Y };
+// out[i] is in[i] moved from origin along axis by scale, returns the count
+int move_points(struct vec2 origin, enum axis along, double scale,
+                const struct vec2 *in, int in_cnt, struct vec2 *out,
+                int out_cnt);